@@ -22,7 +22,7 @@ set COMMON_COMPILER_FLAGS=^
     -MT -nologo -std:c17 -fp:fast -Gm- -Od -Oi -Zi -FC^
     -W4 -WX -wd4100 -wd4101 -wd4189 -wd4127^
 	-wd4245 -wd4244^
-    -DASSERTIONS_ENABLED
+    -DASSERTIONS_ENABLED -DPROFILING_ENABLED
 set COMMON_LINKER_FLAGS=-incremental:no -opt:ref
 
 REM building the game as a dynamic library
@@ -14,14 +14,17 @@ cd "$SCRIPT_DIR_REL"
 
 SRC_DIR=$(realpath ./src)
 SRC_WAY_DIR="$SRC_DIR"/wayland
+GOLDEN_DIR=$(realpath ./goldens)
 
-build_game() {
+# Builds the game lib that every platform loads, leaving us in the build dir with the flags set up.
+build_game_lib() {
 	echo "Building game..."
 
 	mkdir -p build
 	cd build
 
-	DEBUG_COMPILER_FLAGS="-O0 -g3 -DASSERTIONS_ENABLED"
+	# PROFILING_ENABLED = record the profiling zones in profile.h
+	DEBUG_COMPILER_FLAGS="-O0 -g3 -DASSERTIONS_ENABLED -DPROFILING_ENABLED"
 	RELEASE_COMPILER_FLAGS="-O3"
 	COMMON_COMPILER_FLAGS="-std=c17 $DEBUG_COMPILER_FLAGS -ffast-math\
 		-Wall -Wextra -Werror\
@@ -36,6 +39,7 @@ build_game() {
 	# m              = math
 	# wayland_client = core wayland functions
 	# xkbcommon      = keyboard stuff
+	# pthread        = worker threads for the render queue
 
 	# TODO(mal): Move this note about hot reloading into the readme?
 	# NOTE(mal): We create a dummy game.lock file here before compiling/linking
@@ -61,14 +65,72 @@ build_game() {
 		$COMMON_COMPILER_FLAGS $COMMON_LINKER_FLAGS
 	rm game.lock
 	echo "game lib lock file deleted"
+}
+
+build_game() {
+	build_game_lib
 
 	gcc "$SRC_DIR"/platform_linux_wayland.c\
 		"$SRC_WAY_DIR"/xdg_shell_protocol.c "$SRC_WAY_DIR"/xdg_decoration_protocol.c "$SRC_WAY_DIR"/wp_viewporter_protocol.c \
 		-o platform_linux_wayland \
-		-ldl -lwayland-client -lxkbcommon \
+		-ldl -lwayland-client -lxkbcommon -lpthread \
 		$COMMON_COMPILER_FLAGS $COMMON_LINKER_FLAGS
 }
 
+# No window, no wayland: for timing the renderer on machines without a display.
+build_headless() {
+	build_game_lib
+
+	gcc "$SRC_DIR"/platform_linux_headless.c \
+		-o platform_linux_headless \
+		-ldl -lpthread \
+		$COMMON_COMPILER_FLAGS $COMMON_LINKER_FLAGS
+}
+
+# The golden run: a scripted walk through the renderer's modes, captured at GOLDEN_FRAMES (see
+# goldens/input.txt for what's on each). No assets, so it doesn't matter what's lying around locally,
+# and a fixed number of render workers, so that binning and the work queue always run across threads.
+GOLDEN_FRAMES=0,32,36,42,48,61,62,63
+GOLDEN_ARGS="--frames 64 --size 320x180 --workers 3 --no-assets --capture $GOLDEN_FRAMES"
+
+# Compares the golden run against the committed images, once per raster kernel. Failed frames and
+# their diff heatmaps end up in build/golden_failures/kernel_N.
+# NOTE(mal): F4 cycles through the kernels this machine can run, starting from the one it picks by
+# default, so tapping it 0, 1 and 2 times before the script goes through all of them. Tolerance 1
+# because the scalar kernel rounds the odd pixel differently from the SIMD ones.
+golden_check() {
+	build_headless
+
+	rm -rf golden_failures
+	mkdir -p golden_failures
+	local result=0
+	for kernel in 0 1 2; do
+		local kernel_taps=""
+		for ((tap = 0; tap < kernel; tap++)); do
+			kernel_taps+="$((tap * 2)) tap F4"$'\n'
+		done
+
+		echo "# kernel $kernel"
+		./platform_linux_headless $GOLDEN_ARGS \
+			--input <(printf "%s" "$kernel_taps"; cat "$GOLDEN_DIR/input.txt") \
+			--golden "$GOLDEN_DIR" --tolerance 1 --out golden_failures/kernel_$kernel > golden_report_$kernel.csv || result=1
+		grep "^#" golden_report_$kernel.csv
+	done
+
+	# NOTE(mal): No images for this one, it's only here to check that the render targets (visibility
+	# buffer included) fit at 4K. Running out of room trips an assertion and fails the run.
+	echo "# 4K run with the visibility buffer on"
+	./platform_linux_headless --frames 4 --size 3840x2160 --workers 3 --no-assets --input "$GOLDEN_DIR/input_4k.txt" > /dev/null || result=1
+	return $result
+}
+
+# For when a change is supposed to change the picture. Look at what it did before committing!
+golden_update() {
+	build_headless
+
+	./platform_linux_headless $GOLDEN_ARGS --input "$GOLDEN_DIR/input.txt" --out "$GOLDEN_DIR" > /dev/null
+}
+
 generate_wayland() {
 	echo "Generating wayland protocol files..."
 
@@ -99,6 +161,14 @@ clean_wayland() {
 
 if [ -z "$1" ]; then
 	build_game
+elif [[ "$1" = "headless" ]]; then
+	build_headless
+elif [[ "$1" = "golden" ]]; then
+	if [[ "$2" = "update" ]]; then
+		golden_update
+	else
+		golden_check
+	fi
 elif [[ "$1" = "waygen" ]]; then
 	generate_wayland
 elif [[ "$1" = "wayclean" ]]; then
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <math.h>
 #include "platform.h"
+#include "tga.h"
 // NOTE(mal): Only on Linux, probably wrap this in a #if (something)
 // Actually there should be no platform-specific anything in the game layer.
 // All platform-specific behavior should be accessed via the interface that's passed
@@ -12,6 +13,29 @@
 #include <stdlib.h> // for abs at the moment
 #include <string.h>
 
+// NOTE(mal): SIMD rasterization kernels are x64 only. SSE2 is part of the x64 baseline so it's
+// always available there; AVX2 has to be checked for at runtime (see cpu_supports_avx2), and with
+// gcc/clang the AVX2 functions have to be compiled with the avx2 target enabled individually.
+#if defined(__x86_64__) || defined(_M_X64)
+	#define RASTER_SIMD_X64 1
+	#include <immintrin.h>
+	#if defined(_MSC_VER)
+		#include <intrin.h>
+		#define TARGET_AVX2
+	#else
+		#define TARGET_AVX2 __attribute__((target("avx2")))
+	#endif
+#endif
+
+// NOTE(mal): Used to stamp out specialized copies of a function body from a single definition: the
+// body takes its specialization as a constant argument and the wrappers get their own copy with
+// that argument folded away (see DEFINE_RASTER_TILE_KERNELS).
+#if defined(_MSC_VER)
+	#define FORCE_INLINE static __forceinline
+#else
+	#define FORCE_INLINE static inline __attribute__((always_inline))
+#endif
+
 #define PI 3.14159f
 // TODO(mal): remove if unused, just added for fun
 #define DEGREES_TO_RADIANS(deg) ((deg) * PI / 180.0f)
@@ -94,6 +118,15 @@ Vec3 mult_vec3_scalar(Vec3 v, float s) {
 	return result;
 }
 
+// a + (b - a) * t
+Vec3 vec3_lerp(Vec3 a, Vec3 b, float t) {
+	Vec3 result = {};
+	result.x = a.x + (b.x - a.x) * t;
+	result.y = a.y + (b.y - a.y) * t;
+	result.z = a.z + (b.z - a.z) * t;
+	return result;
+}
+
 // NOTE(mal): With homogeneous notation, vectors w = 0, points w = 1
 typedef union Vec4 {
 	float elements[4];
@@ -296,6 +329,111 @@ Mat4x4 mult_mat4x4_mat4x4(Mat4x4 a, Mat4x4 b) {
 	return result;
 }
 
+// Builds the local --> world transform of an object that gets uniformly scaled, then rotated, then
+// translated.
+Mat4x4 mat4x4_create_local_to_world(Vec3 position, Mat3x3 orientation, float scale) {
+	Mat4x4 result = {0};
+
+	for (int r = 0; r < 3; r++) {
+		for (int c = 0; c < 3; c++) {
+			result.rows[r][c] = orientation.rows[r][c] * scale;
+		}
+		result.rows[r][3] = position.elements[r];
+	}
+	result.rows[3][3] = 1;
+
+	return result;
+}
+
+// Inverse of an affine transform, i.e. one whose bottom row is (0, 0, 0, 1): M = [A t; 0 1] so
+// M^-1 = [A^-1 -A^-1*t; 0 1]. Much cheaper than mat4x4_inverse, and A^-1 comes from its adjugate so
+// this also works for transforms with (non-uniform) scale or shear, not just rotations.
+// NOTE(mal): See "Essential Math" 4.3.6 on p136.
+Mat4x4 mat4x4_inverse_affine(Mat4x4 m) {
+	float (*a)[4] = m.rows;
+	Mat4x4 result = {0};
+	float (*b)[4] = result.rows;
+
+	// Cofactors of A, transposed (the adjugate)
+	b[0][0] = a[1][1] * a[2][2] - a[1][2] * a[2][1];
+	b[0][1] = a[0][2] * a[2][1] - a[0][1] * a[2][2];
+	b[0][2] = a[0][1] * a[1][2] - a[0][2] * a[1][1];
+	b[1][0] = a[1][2] * a[2][0] - a[1][0] * a[2][2];
+	b[1][1] = a[0][0] * a[2][2] - a[0][2] * a[2][0];
+	b[1][2] = a[0][2] * a[1][0] - a[0][0] * a[1][2];
+	b[2][0] = a[1][0] * a[2][1] - a[1][1] * a[2][0];
+	b[2][1] = a[0][1] * a[2][0] - a[0][0] * a[2][1];
+	b[2][2] = a[0][0] * a[1][1] - a[0][1] * a[1][0];
+
+	float determinant = a[0][0] * b[0][0] + a[0][1] * b[1][0] + a[0][2] * b[2][0];
+	ASSERT_MSG(determinant != 0.0f, "Inverting a singular transform");
+	float reciprocal_determinant = 1.0f / determinant;
+	for (int r = 0; r < 3; r++) {
+		for (int c = 0; c < 3; c++) {
+			b[r][c] *= reciprocal_determinant;
+		}
+	}
+
+	for (int r = 0; r < 3; r++) {
+		b[r][3] = -(b[r][0] * a[0][3] + b[r][1] * a[1][3] + b[r][2] * a[2][3]);
+	}
+	b[3][3] = 1;
+
+	return result;
+}
+
+// Inverse of any invertible 4x4 matrix (e.g. one with a projection in it). Writes the inverse to
+// result and returns true, or returns false if m is singular.
+// NOTE(mal): Laplace expansion, using the 2x2 determinants of the top two rows (s) and the bottom
+// two rows (c). Every 3x3 cofactor is then a combination of three of those, and the determinant of
+// the whole matrix is sum(s_i * c_(5-i)) with alternating signs.
+bool mat4x4_inverse(Mat4x4 m, Mat4x4 *result) {
+	float (*a)[4] = m.rows;
+
+	float s0 = a[0][0] * a[1][1] - a[1][0] * a[0][1];
+	float s1 = a[0][0] * a[1][2] - a[1][0] * a[0][2];
+	float s2 = a[0][0] * a[1][3] - a[1][0] * a[0][3];
+	float s3 = a[0][1] * a[1][2] - a[1][1] * a[0][2];
+	float s4 = a[0][1] * a[1][3] - a[1][1] * a[0][3];
+	float s5 = a[0][2] * a[1][3] - a[1][2] * a[0][3];
+
+	float c5 = a[2][2] * a[3][3] - a[3][2] * a[2][3];
+	float c4 = a[2][1] * a[3][3] - a[3][1] * a[2][3];
+	float c3 = a[2][1] * a[3][2] - a[3][1] * a[2][2];
+	float c2 = a[2][0] * a[3][3] - a[3][0] * a[2][3];
+	float c1 = a[2][0] * a[3][2] - a[3][0] * a[2][2];
+	float c0 = a[2][0] * a[3][1] - a[3][0] * a[2][1];
+
+	float determinant = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+	if (determinant == 0.0f) {
+		return false;
+	}
+	float r = 1.0f / determinant;
+
+	float (*b)[4] = result->rows;
+	b[0][0] = ( a[1][1] * c5 - a[1][2] * c4 + a[1][3] * c3) * r;
+	b[0][1] = (-a[0][1] * c5 + a[0][2] * c4 - a[0][3] * c3) * r;
+	b[0][2] = ( a[3][1] * s5 - a[3][2] * s4 + a[3][3] * s3) * r;
+	b[0][3] = (-a[2][1] * s5 + a[2][2] * s4 - a[2][3] * s3) * r;
+
+	b[1][0] = (-a[1][0] * c5 + a[1][2] * c2 - a[1][3] * c1) * r;
+	b[1][1] = ( a[0][0] * c5 - a[0][2] * c2 + a[0][3] * c1) * r;
+	b[1][2] = (-a[3][0] * s5 + a[3][2] * s2 - a[3][3] * s1) * r;
+	b[1][3] = ( a[2][0] * s5 - a[2][2] * s2 + a[2][3] * s1) * r;
+
+	b[2][0] = ( a[1][0] * c4 - a[1][1] * c2 + a[1][3] * c0) * r;
+	b[2][1] = (-a[0][0] * c4 + a[0][1] * c2 - a[0][3] * c0) * r;
+	b[2][2] = ( a[3][0] * s4 - a[3][1] * s2 + a[3][3] * s0) * r;
+	b[2][3] = (-a[2][0] * s4 + a[2][1] * s2 - a[2][3] * s0) * r;
+
+	b[3][0] = (-a[1][0] * c3 + a[1][1] * c1 - a[1][2] * c0) * r;
+	b[3][1] = ( a[0][0] * c3 - a[0][1] * c1 + a[0][2] * c0) * r;
+	b[3][2] = (-a[3][0] * s3 + a[3][1] * s1 - a[3][2] * s0) * r;
+	b[3][3] = ( a[2][0] * s3 - a[2][1] * s1 + a[2][2] * s0) * r;
+
+	return true;
+}
+
 // https://www.scratchapixel.com/lessons/mathematics-physics-for-computer-graphics/lookat-function/framing-lookat-function.html
 // WARN(mal): Have not tested this yet. May or may not work with the way I have my world axes set
 // up. Not sure yet.
@@ -368,56 +506,346 @@ typedef struct Triangle3D {
 	float  scale;
 } Triangle3D;
 
+// An object's local --> clip transform, along with everything it was composed from. See
+// compose_local_to_clip.
+typedef struct TransformCache {
+	Vec3     world_position;
+	Mat3x3   world_orientation;
+	float    scale;
+	uint32_t view_version; // 0 = never composed
+	Mat4x4   local_to_clip;
+} TransformCache;
+
+// Everything that depends only on the camera and the size of the screen. See update_view_transforms.
+typedef struct ViewTransforms {
+	Vec3     camera_world_position;
+	Mat3x3   camera_world_orientation;
+	int      width;
+	int      height;
+	uint32_t version; // bumped every time the transforms below change
+	Mat4x4   world_to_clip;
+	Mat4x4   ndc_to_screen;
+} ViewTransforms;
+
 // A square in 3D space, constructed from two triangles
 typedef struct Square3D {
-	Vertex local_vertices[4];
-	int    vertex_list[6];
-	Vec3   world_position;    // (x, y, z) in world space
- 	Mat3x3 world_orientation; // degrees in world space
-	float  scale;
+	Vertex   local_vertices[4];
+	uint32_t vertex_list[6];
+	Vec3     world_position;    // (x, y, z) in world space
+ 	Mat3x3   world_orientation; // degrees in world space
+	float    scale;
+	TransformCache transform_cache;
 } Square3D;
 
+// NOTE(mal): Vertex streams are padded out to a multiple of this many vertices so that the SIMD
+// vertex transform kernels never have to deal with a partial batch.
+#define VERTEX_BATCH_SIZE 8
+#define VERTEX_BATCH_PADDED_COUNT(count) (((count) + VERTEX_BATCH_SIZE - 1) & ~(VERTEX_BATCH_SIZE - 1))
+
+// Which of a mesh's triangles get dropped during triangle setup, by which way they face the camera.
+// Front faces are the ones that end up CW on screen (see Mesh).
+typedef enum CullMode {
+	CULL_MODE_NONE,
+	CULL_MODE_BACK,
+	CULL_MODE_FRONT,
+	CULL_MODE_COUNT,
+} CullMode;
+
+const char *cull_mode_names[CULL_MODE_COUNT] = {
+	[CULL_MODE_NONE]  = "none",
+	[CULL_MODE_BACK]  = "back",
+	[CULL_MODE_FRONT] = "front",
+};
+
+// An indexed triangle list in local space. Every 3 indices are one triangle in CW winding order.
+typedef struct Mesh {
+	Vertex   *vertices;
+	uint32_t  vertex_count;
+	uint32_t *indices;
+	uint32_t  index_count;
+	CullMode  cull_mode;
+	// The vertices' local space positions again, split into separate streams (structure of arrays)
+	// for the vertex transform. w is always 1. See mesh_build_position_streams.
+	float *positions_x;
+	float *positions_y;
+	float *positions_z;
+} Mesh;
+
+// NOTE(mal): Guard band clipping. Rather than clipping triangles to the sides of the frustum, they're
+// allowed to extend past the screen (the rasterizer only ever visits pixels on the screen anyway)
+// as long as they stay inside a band GUARD_BAND_EXTENT times the size of the screen. Only triangles
+// that cross the near/far planes or leave the guard band need clipping at all.
+// WARN(mal): The guard band mustn't get anywhere near the limits of the rasterizer's fixed point
+// coordinates (see RASTER_SUBPIXEL_BITS), and the float edge functions used for interpolation lose
+// precision as triangles get bigger.
+#define GUARD_BAND_EXTENT 8.0f
+
+// Planes that a clip space position is outside of
+typedef enum Outcode {
+	OUTCODE_POSITIVE_X = 1 << 0, // x >  w
+	OUTCODE_NEGATIVE_X = 1 << 1, // x < -w
+	OUTCODE_POSITIVE_Y = 1 << 2,
+	OUTCODE_NEGATIVE_Y = 1 << 3,
+	OUTCODE_POSITIVE_Z = 1 << 4,
+	OUTCODE_NEGATIVE_Z = 1 << 5,
+	OUTCODE_GUARD_BAND_X = 1 << 6, // |x| > GUARD_BAND_EXTENT * w
+	OUTCODE_GUARD_BAND_Y = 1 << 7, // |y| > GUARD_BAND_EXTENT * w
+} Outcode;
+#define OUTCODE_FRUSTUM_PLANES    0x3F
+#define OUTCODE_NEAR_FAR_PLANES   (OUTCODE_POSITIVE_Z | OUTCODE_NEGATIVE_Z)
+#define OUTCODE_GUARD_BAND_PLANES (OUTCODE_GUARD_BAND_X | OUTCODE_GUARD_BAND_Y)
+
+// Output of the vertex transform: homogeneous clip space positions and their outcodes, indexed the
+// same as the mesh's vertices.
+typedef struct ClipPositions {
+	float   *x;
+	float   *y;
+	float   *z;
+	float   *w;
+	uint8_t *outcodes;
+} ClipPositions;
+
 typedef enum RenderRasterTileState {
 	RENDER_RASTER_TILES_OFF,
 	RENDER_RASTER_TILES_BELOW,
 	RENDER_RASTER_TILES_ONTOP,
 } RenderRasterTileState;
 
-// TODO(mal): It will be critical in the future to introduce some memory allocators and start
-// using them to store some of the data in here. For example, loaded texture data and whatnot.
-// The backing stores of these allocators will be the rest of our GameMemory.storage excluding
-// the GameState structure.
-typedef struct GameState {
-	// Triangle3D triangle;
-	Square3D square;
+// Which implementation of the per-tile pixel loop to use. Switchable at runtime so that the SIMD
+// kernels can be A/B'd against the scalar reference.
+typedef enum RasterKernel {
+	RASTER_KERNEL_SCALAR,
+	RASTER_KERNEL_SSE2, // 4x1 pixel blocks
+	RASTER_KERNEL_AVX2, // 8x1 pixel blocks
+	RASTER_KERNEL_COUNT,
+} RasterKernel;
+
+const char *raster_kernel_names[RASTER_KERNEL_COUNT] = {
+	[RASTER_KERNEL_SCALAR] = "scalar",
+	[RASTER_KERNEL_SSE2]   = "sse2",
+	[RASTER_KERNEL_AVX2]   = "avx2",
+};
+
+// When the depth buffer gets reset to the clear value.
+typedef enum DepthClearPolicy {
+	DEPTH_CLEAR_EVERY_FRAME, // the whole buffer, up front, on the main thread
+	DEPTH_CLEAR_PER_BIN,     // each bin by its render worker right before rasterizing into it
+	DEPTH_CLEAR_NEVER,       // debugging aid: depth accumulates across frames
+	DEPTH_CLEAR_POLICY_COUNT,
+} DepthClearPolicy;
+
+const char *depth_clear_policy_names[DEPTH_CLEAR_POLICY_COUNT] = {
+	[DEPTH_CLEAR_EVERY_FRAME] = "every frame",
+	[DEPTH_CLEAR_PER_BIN]     = "per bin",
+	[DEPTH_CLEAR_NEVER]       = "never",
+};
+
+bool cpu_supports_avx2() {
+	bool result = false;
+#if defined(RASTER_SIMD_X64) && defined(_MSC_VER)
+	int cpu_info[4];
+	__cpuid(cpu_info, 1);
+	bool os_uses_xsave = (cpu_info[2] & (1 << 27)) != 0;
+	bool cpu_has_avx   = (cpu_info[2] & (1 << 28)) != 0;
+	if (os_uses_xsave && cpu_has_avx) {
+		// The OS also has to be saving the YMM registers on context switches
+		bool os_saves_ymm = (_xgetbv(0) & 0x6) == 0x6;
+		__cpuidex(cpu_info, 7, 0);
+		result = os_saves_ymm && (cpu_info[1] & (1 << 5)) != 0;
+	}
+#elif defined(RASTER_SIMD_X64)
+	__builtin_cpu_init();
+	result = __builtin_cpu_supports("avx2") != 0;
+#endif
+	return result;
+}
+
+// NOTE(mal): Simple linear (bump) allocator. Anything pushed onto an arena lives until the arena
+// is reset; there is no freeing of individual allocations.
+typedef struct MemoryArena {
+	uint8_t *base;
+	size_t   size;
+	size_t   used;
+} MemoryArena;
+
+void initialize_arena(MemoryArena *arena, void *base, size_t size) {
+	arena->base = (uint8_t *)base;
+	arena->size = size;
+	arena->used = 0;
+}
+
+// NOTE(mal): 16 so that anything we push can be used with aligned SSE loads/stores.
+#define ARENA_ALIGNMENT 16
+void *push_size(MemoryArena *arena, size_t size) {
+	size_t result_address   = (size_t)(arena->base + arena->used);
+	size_t alignment_offset = (ARENA_ALIGNMENT - (result_address & (ARENA_ALIGNMENT - 1))) & (ARENA_ALIGNMENT - 1);
+	ASSERT_MSG(arena->used + alignment_offset + size <= arena->size, "Memory arena overflow!");
+	void *result = arena->base + arena->used + alignment_offset;
+	arena->used += alignment_offset + size;
+	return result;
+}
+#define push_struct(arena, Type) ((Type *)push_size((arena), sizeof(Type)))
+#define push_array(arena, count, Type) ((Type *)push_size((arena), (count) * sizeof(Type)))
+
+// Conservative bounds on the depths currently stored in one raster tile of the depth buffer, so
+// that the tile loop can reject a triangle for a whole tile without touching the depth buffer.
+// NOTE(mal): The bounds only ever move outward while drawing, except when a triangle covers an
+// entire tile (see hierarchical_depth_test), so they can be looser than the real range but never
+// tighter.
+typedef struct TileDepthRange {
+	float nearest;
+	float farthest;
+} TileDepthRange;
+
+// NOTE(mal): Visibility buffer. Rather than texturing every pixel that passes the depth test (only
+// for it to get overwritten by whatever gets drawn over it later), rasterization just records which
+// triangle ended up covering each pixel and where, and texturing happens in a separate resolve pass
+// once the bin is done (see resolve_visibility_rect). Every pixel gets textured exactly once
+// regardless of overdraw.
+typedef struct VisibilitySample {
+	uint32_t triangle_index; // into RenderFrame.triangles, VISIBILITY_SAMPLE_EMPTY if nothing covers the pixel
+	// Perspective correct barycentric weights of the triangle's vertices 1 and 2, in 0.16 fixed
+	// point. Vertex 0's weight is whatever is left over.
+	uint16_t b1, b2;
+} VisibilitySample;
+
+#define VISIBILITY_SAMPLE_EMPTY UINT32_MAX
+
+// Everything game_update owns. The renderer never reads this directly, only the immutable
+// snapshots of it that game_update publishes (see SimSnapshots), so that update is free to run on
+// its own thread while a frame is being rendered.
+typedef struct SimState {
 	float rotation_y_degrees;
 	Vec3 camera_world_position;
+	// As of the tick before, so that render can interpolate between the last two ticks.
+	float previous_rotation_y_degrees;
+	Vec3 previous_camera_world_position;
 	Mat3x3 camera_world_orientation; // euler angles
-	unsigned texture_width;
-	unsigned texture_height;
-	uint32_t *texture_pixels;
+	Vec3 square_world_position;
+	float square_scale;
+	CullMode square_cull_mode;
+	bool render_stress_mesh;
+	bool guard_band_clipping;
 	bool render_wireframe;
 	bool skip_rasterization;
 	RenderRasterTileState render_raster_tile_state;
+	RasterKernel raster_kernel;
+	bool has_avx2;
+	bool watertight_test;
+	DepthClearPolicy depth_clear_policy;
+	// Store near/w instead of [0, 1] screen space z. Nearer is greater, which spreads float precision
+	// much more evenly over the depth range (see setup in game_render).
+	bool reverse_z;
+	bool hierarchical_z;
+	bool visibility_buffer; // defer texturing to a resolve pass, see VisibilitySample
+} SimState;
+
+// NOTE(mal): Triple rather than double buffered so that neither side ever has to wait on the other:
+// at any time one slot is being written by update, one is being read by render and the third holds
+// the most recently published snapshot. Publishing and acquiring are each a single atomic exchange
+// of the mailbox with the slot the caller is giving up.
+#define SIM_SNAPSHOT_COUNT 3
+#define SIM_SNAPSHOT_FRESH 0x80000000u // set in the mailbox until render picks the snapshot up
+typedef struct SimSnapshots {
+	SimState slots[SIM_SNAPSHOT_COUNT];
+	volatile uint32_t mailbox; // slot index, plus SIM_SNAPSHOT_FRESH
+} SimSnapshots;
+
+#if defined(_MSC_VER)
+	#include <intrin.h>
+	#define atomic_exchange_u32(ptr, value) ((uint32_t)_InterlockedExchange((volatile long *)(ptr), (long)(value)))
+	#define atomic_load_u32(ptr)            ((uint32_t)_InterlockedOr((volatile long *)(ptr), 0))
+#else
+	#define atomic_exchange_u32(ptr, value) __atomic_exchange_n((ptr), (value), __ATOMIC_ACQ_REL)
+	#define atomic_load_u32(ptr)            __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#endif
+
+// Hands the state over to render and takes back whichever slot render isn't using.
+void publish_sim_snapshot(SimSnapshots *snapshots, uint32_t *write_slot, SimState *state) {
+	snapshots->slots[*write_slot] = *state;
+	uint32_t previous = atomic_exchange_u32(&snapshots->mailbox, *write_slot | SIM_SNAPSHOT_FRESH);
+	*write_slot = previous & ~SIM_SNAPSHOT_FRESH;
+}
+
+// Returns the most recently published snapshot, which stays valid (and unchanged) until the next
+// call. If nothing new was published since the last call that's the same snapshot again.
+SimState *acquire_sim_snapshot(SimSnapshots *snapshots, uint32_t *read_slot) {
+	if (atomic_load_u32(&snapshots->mailbox) & SIM_SNAPSHOT_FRESH) {
+		uint32_t previous = atomic_exchange_u32(&snapshots->mailbox, *read_slot);
+		*read_slot = previous & ~SIM_SNAPSHOT_FRESH;
+	}
+	return &snapshots->slots[*read_slot];
+}
+
+// Meshes for the canned scenes the platform can ask for instead of the game's own (see
+// GameBenchmarkScene and submit_benchmark_scene).
+typedef struct BenchmarkMeshes {
+	Mesh fullscreen_quad;
+	Mesh small_triangles;
+	Mesh near_clip;
+	Mesh texture_magnified;
+	Mesh texture_minified;
+} BenchmarkMeshes;
+
+// Everything game_render owns. Nothing in here is touched by game_update.
+typedef struct GameState {
+	uint32_t sim_snapshot_read_slot;
+	// Scratch memory for the renderer. Reset at the start of every game_render.
+	MemoryArena frame_arena;
+	// Memory that lives as long as the game does (e.g. generated meshes). Never reset.
+	MemoryArena asset_arena;
+	// Buffers that have to persist across frames and match the offscreen buffer's size (e.g. the
+	// depth buffer). Reset and reallocated whenever the offscreen buffer's size changes.
+	MemoryArena render_target_arena;
+	int render_target_width;
+	int render_target_height;
+	float *depth_buffer;
+	// Forces a depth clear next frame regardless of the clear policy, e.g. after (re)allocating the
+	// depth buffer or switching depth conventions.
+	bool depth_buffer_invalid;
+	// What the depth buffer was last drawn with, so that we notice when a snapshot switches them.
+	bool depth_buffer_reverse_z;
+	bool depth_buffer_hierarchical_z;
+	// One per raster tile, alongside the depth buffer
+	TileDepthRange *tile_depth_ranges;
+	int tile_count_x;
+	// One per render bin, alongside the depth buffer. A hash of what the bin's pixels were last
+	// frame, for telling which bins changed (see build_damage_rects).
+	uint64_t *bin_pixel_hashes;
+	// Always allocated, whether or not it's in use, so that turning it on can't run out of memory
+	// mid-frame. Each bin clears its part before use, nothing in it outlives a frame.
+	VisibilitySample *visibility_buffer;
+	// Forces the whole frame to be damaged next frame, e.g. after (re)allocating the hashes or
+	// drawing over the bins after they were hashed.
+	bool bin_pixel_hashes_invalid;
+	// Triangle3D triangle;
+	Square3D square;
+	Mesh square_mesh; // references square's vertices
+	Mesh stress_mesh;
+	TransformCache stress_mesh_transform_cache;
+	BenchmarkMeshes benchmark_meshes;
+	ViewTransforms view;
+	unsigned texture_width;
+	unsigned texture_height;
+	uint32_t *texture_pixels;
+	uint32_t watertight_test_seed;
 } GameState;
 
-// http://www.paulbourke.net/dataformats/tga/
-#pragma pack(push, 1)
-typedef struct TGA_Header {
-	char  idlength;
-	char  colourmaptype;
-	char  datatypecode;
-	short colourmaporigin;
-	short colourmaplength;
-	char  colourmapdepth;
-	short x_origin;
-	short y_origin;
-	short width;
-	short height;
-	char  bitsperpixel;
-	char  imagedescriptor;
-} TGA_Header;
-#pragma pack(pop)
+// How GameMemory.storage is split up. The sim-owned region is only ever touched by game_update, the
+// render-owned region (this GameState plus the arenas after the struct) only by game_render, and the
+// two only meet in the snapshots. Each region starts on its own cache line so the update and render
+// threads never share one.
+// NOTE(mal): game_init is the exception, it sets up both sides before either thread is running.
+#define CACHE_LINE_SIZE 64
+typedef struct GameStorage {
+	// Sim-owned
+	_Alignas(CACHE_LINE_SIZE) SimState sim;
+	uint32_t sim_snapshot_write_slot;
+	// Shared
+	_Alignas(CACHE_LINE_SIZE) SimSnapshots snapshots;
+	// Render-owned
+	_Alignas(CACHE_LINE_SIZE) GameState render;
+} GameStorage;
 
 // v0 - first vertex, v1 - second vertex, p - test point
 // Assumes a clockwise winding order.
@@ -461,17 +889,19 @@ float edge_function_2(float nx, float ny, float sx, float sy, float c) {
 
 // FIXME(mal): Take input_capacity and output_capacity parameters to ensure we don't overflow buffers.
 // NOTE(mal): Currently, this assumes that the input capacity and the output capacity are the same!
-size_t clip_sutherland_hodgeman(int plane_index, int plane_sign, Vertex *input, size_t input_count, Vertex *output) {
+// The plane is extent * w + plane_sign * position[plane_index] = 0, where extent is 1 for the sides of
+// the frustum and GUARD_BAND_EXTENT for the sides of the guard band.
+size_t clip_sutherland_hodgeman(int plane_index, int plane_sign, float extent, Vertex *input, size_t input_count, Vertex *output) {
 	size_t output_count = 0;
 
 	// Clip edge from start_vertex to end_vertex against the plane.
 	// We will do this sequentially for each edge in the polygon.
 	Vertex *start_vertex = &input[input_count - 1];
-	float dist_start_vertex_to_plane = start_vertex->position.w + plane_sign * start_vertex->position.elements[plane_index];
+	float dist_start_vertex_to_plane = extent * start_vertex->position.w + plane_sign * start_vertex->position.elements[plane_index];
 	int   start_vertex_inside_plane  = dist_start_vertex_to_plane >= 0;
 	for (int i = 0; i < input_count; i++) {
 		Vertex *end_vertex = &input[i];
-		float dist_end_vertex_to_plane = end_vertex->position.w + plane_sign * end_vertex->position.elements[plane_index];
+		float dist_end_vertex_to_plane = extent * end_vertex->position.w + plane_sign * end_vertex->position.elements[plane_index];
 		int   end_vertex_inside_plane  = dist_end_vertex_to_plane >= 0;
 
 		// We only want to output vertices if at least one of endpoints is inside the plane.
@@ -536,655 +966,2626 @@ size_t clip_sutherland_hodgeman(int plane_index, int plane_sign, Vertex *input,
 	return output_count;
 }
 
+// NOTE(mal): Coverage is decided with fixed point edge functions. Vertex positions are snapped to
+// a grid of 1/2^RASTER_SUBPIXEL_BITS of a pixel (28.4 fixed point), after which the edge functions
+// are evaluated exactly in integers. This is what makes the fill rule below work: two triangles
+// that share an edge produce edge function values that are exact negatives of each other, so a
+// pixel center lying exactly on the shared edge evaluates to exactly 0 for both.
+// WARN(mal): Snapped coordinates and the differences between them are kept in 32 bits, which limits
+// screen space coordinates to roughly +-2^26 pixels. The edge functions themselves are evaluated in
+// 64 bits during setup and only stepped in 32 bits by the tile kernels (see clamp_fixed_edge_value).
+#define RASTER_SUBPIXEL_BITS  4
+#define RASTER_SUBPIXEL_STEPS (1 << RASTER_SUBPIXEL_BITS)
+
+int32_t snap_to_subpixel(float screen_coordinate) {
+	int32_t result = (int32_t)floorf(screen_coordinate * RASTER_SUBPIXEL_STEPS + 0.5f);
+	return result;
+}
+
 // Our normals assume a CW winding order in a coordinate system where +Y is down.
 // i.e. our normals point inward to our triangles when in screen space.
-// For some reason I couldn't get the standard top-left rule working to not produce gaps, 
-// but this version where we nudge "nudge the bottom and right edges over by a pixel to
-// allow inclusion of pixels that might be along a shared edge there" seems to work.
-// This may cause slight overdraw if surfaces are transparent. Might have to visit later.
-// FIXME(mal): If overdraw on shared edges of transparent polygons, will have to fix this
-// properly by using the true top-left rule. Apparently for the true top-left rule to work,
-// the edge function will have to evaluate to exactly 0.0f for shared pixel edges which only
-// holds when shared vertices are bit-identical. If there's any floating point drift then
-// adding a bias of -1 to non-top-or-right edges will create gaps due to underdrawing.
-float bottom_right_bias(float triangle_edge_nx, float triangle_edge_ny) {
-	bool is_bottom = (triangle_edge_nx == 0.0f) && (triangle_edge_ny < 0.0f);
-	bool is_right  = triangle_edge_nx < 0.0f;
-	float result   = (is_bottom || is_right) ? 1.0f : 0.0f;
+// Top-left fill rule: a pixel center lying exactly on an edge belongs to the triangle only if that
+// edge is a top edge (exactly horizontal, with the triangle below it) or a left edge (the triangle
+// is to its right). Every other edge gets a bias of -1 (the smallest fixed point step), which turns
+// its "w >= 0" coverage test into "w > 0". Since exactly one of two triangles sharing an edge sees
+// it as top/left, pixels on shared edges are drawn exactly once.
+int64_t top_left_bias(int32_t fixed_edge_nx, int32_t fixed_edge_ny) {
+	bool is_top  = (fixed_edge_nx == 0) && (fixed_edge_ny > 0);
+	bool is_left = fixed_edge_nx > 0;
+	int64_t result = (is_top || is_left) ? 0 : -1;
 	return result;
 }
 
-EXPORT void game_init(GameMemory *memory, int initial_width, int initial_height) {
-	ASSERT(memory->debug_platform_read_entire_file);
-	ASSERT(memory->debug_platform_free_entire_file);
-
-	GameState *game_state = (GameState *)memory->storage;
+// NOTE(mal): MUST be powers of 2!
+#define RASTER_TILE_WIDTH  16
+#define RASTER_TILE_HEIGHT 16
+// NOTE(mal): Partially covered raster tiles are subdivided into blocks of this size before running
+// any per-pixel coverage tests. MUST be powers of 2 and divide the raster tile dimensions.
+#define RASTER_BLOCK_WIDTH  4
+#define RASTER_BLOCK_HEIGHT 4
+// NOTE(mal): Triangles whose AABB is at most this big bypass the tile hierarchy and get rasterized
+// straight from their AABB (see rasterize_triangle_in_rect).
+#define SMALL_TRIANGLE_MAX_WIDTH  RASTER_TILE_WIDTH
+#define SMALL_TRIANGLE_MAX_HEIGHT RASTER_TILE_HEIGHT
+// NOTE(mal): Bins are the unit of work that we hand off to the render worker threads. Each bin
+// covers a disjoint rectangle of the offscreen buffer so no two workers ever touch the same pixel.
+// MUST be multiples of the raster tile dimensions so that tiles never straddle two bins.
+#define RENDER_BIN_WIDTH  64
+#define RENDER_BIN_HEIGHT 64
+#define CLEAR_COLOR 0x00000000
+#define RASTER_TILE_COLOR 0x00440011
+
+typedef struct TriangleEdge {
+	// NOTE(mal): The float edge function is only used to interpolate vertex attributes. Coverage is
+	// always decided by the fixed point one.
+	float nx, ny; // edge normal
+	float c;      // -N dot edge_start_vertex
+	// Same edge in fixed point (see RASTER_SUBPIXEL_BITS), with the fill rule bias folded into c.
+	// Evaluated at a sample point in subpixel units, the result has 2 * RASTER_SUBPIXEL_BITS
+	// fractional bits.
+	int32_t fixed_nx, fixed_ny;
+	int64_t fixed_c;
+	// Offsets from a tile's min corner to the tile corner that is the furthest inside/outside
+	// of this edge, in units of the tile's dimensions (so each component is either 0 or 1). This
+	// way the same offsets work for every level of the tile hierarchy (bin, tile, block).
+	Vec2 tile_offset_most_inside;
+	Vec2 tile_offset_most_outside;
+} TriangleEdge;
+
+// A post-clip triangle in screen space with everything the tile loop needs precomputed.
+typedef struct RasterTriangle {
+	Vertex vertices[3];
+	float  reciprocal_depth[3];
+	// AABB in screen space
+	int xmin, xmax, ymin, ymax;
+	// NOTE(mal): Indexed by the barycentric weight that the edge produces, which is the edge
+	// OPPOSITE the given vertex:
+	// edges[0] = v1v2 --> w0
+	// edges[1] = v2v0 --> w1
+	// edges[2] = v0v1 --> w2
+	TriangleEdge edges[3];
+	// The value written to the depth buffer is vertices[i].position.z, which is affine in screen
+	// space (unlike the vertex attributes) so it's simply stepped across the triangle with these.
+	float depth_dx, depth_dy;
+	// Range of the vertices' depths (i.e. of every depth the triangle can produce)
+	float min_depth, max_depth;
+} RasterTriangle;
+
+// Everything the render workers need to rasterize a frame. Lives in the frame arena.
+typedef struct RenderFrame {
+	uint32_t *pixels;
+	int       width;
+	int       height;
 
-	// Square in CW winding order
-	// 0: Square bottom left
-	game_state->square.local_vertices[0] = (Vertex){
-		.position = { .x = -1, .y = -1, .w = 1 },
-		.color = -1,
-		.tx_u = 0.0f, .tx_v = 1.0f,
-	};
-	// 1: Square top left
-	game_state->square.local_vertices[1] = (Vertex){
-		.position = { .x = -1, .y = 1, .w = 1 },
-		.color = -1,
-		.tx_u = 0.0f, .tx_v = 0.0f,
-	};
-	// 2: Square top right
-	game_state->square.local_vertices[2] = (Vertex){
-		.position = { .x = 1, .y = 1, .w = 1 },
-		.color = -1,
-		.tx_u = 1.0f, .tx_v = 0.0f,
+	uint32_t *texture_pixels;
+	unsigned  texture_width;
+	unsigned  texture_height;
+
+	RasterKernel raster_kernel;
+	// NOTE(mal): Only set when running the watertightness test, in which case nothing is drawn to
+	// pixels and the rasterizer instead counts the number of times each pixel is covered.
+	uint8_t *overdraw_counts;
+
+	// Same dimensions as pixels
+	float *depth_buffer;
+	DepthClearPolicy depth_clear_policy;
+	bool reverse_z; // if set, greater depth is nearer
+	// One per raster tile, row major. NULL if hierarchical Z is disabled.
+	TileDepthRange *tile_depth_ranges;
+	int tile_count_x;
+	// Same dimensions as pixels. NULL unless texturing is deferred to a resolve pass (see
+	// VisibilitySample).
+	VisibilitySample *visibility_buffer;
+
+	// Used by the geometry stages to get from homogeneous clip space to screen space
+	Mat4x4 ndc_to_screen;
+	float  near_plane; // view space distance, for reverse Z
+	bool   guard_band_clipping;
+
+	RasterTriangle *triangles;
+	uint32_t        triangle_count;
+	uint32_t        triangle_capacity;
+	// Debugging aids. With rasterization skipped the bin jobs only clear the frame.
+	bool skip_rasterization;
+	RenderRasterTileState raster_tile_grid;
+
+	// Bin b's triangles are bin_triangle_indices[bin_triangle_offsets[b]] up to (but not including)
+	// bin_triangle_indices[bin_triangle_offsets[b + 1]], in submission order.
+	int       bin_count_x;
+	int       bin_count_y;
+	uint32_t *bin_triangle_offsets;
+	uint32_t *bin_triangle_indices;
+	// One per bin. Hashes persist across frames, damage flags are set if the hash changed.
+	uint64_t *bin_pixel_hashes;
+	uint8_t  *bin_damaged;
+} RenderFrame;
+
+typedef struct RenderBinJob {
+	RenderFrame *frame;
+	int bin_x;
+	int bin_y;
+} RenderBinJob;
+
+// start_fixed/end_fixed are the subpixel snapped (x, y) positions of start and end.
+void setup_triangle_edge(TriangleEdge *edge, Vertex *start, Vertex *end, int32_t *start_fixed, int32_t *end_fixed) {
+	edge->nx =  (end->position.y - start->position.y);
+	edge->ny = -(end->position.x - start->position.x);
+	edge->c =
+		// -N dot edge_start_vertex
+		  (-edge->nx * start->position.x)
+		+ (-edge->ny * start->position.y);
+
+	edge->fixed_nx =  (end_fixed[1] - start_fixed[1]);
+	edge->fixed_ny = -(end_fixed[0] - start_fixed[0]);
+	edge->fixed_c =
+		  (-(int64_t)edge->fixed_nx * start_fixed[0])
+		+ (-(int64_t)edge->fixed_ny * start_fixed[1])
+		+ top_left_bias(edge->fixed_nx, edge->fixed_ny);
+
+	edge->tile_offset_most_inside = (Vec2){
+		.x = edge->fixed_nx < 0 ? 0.0f : 1.0f,
+		.y = edge->fixed_ny < 0 ? 0.0f : 1.0f,
 	};
-	// 3: Square bottom right
-	game_state->square.local_vertices[3] = (Vertex){
-		.position = { .x = 1, .y = -1, .w = 1 },
-		.color = -1,
-		.tx_u = 1.0f, .tx_v = 1.0f,
+	edge->tile_offset_most_outside = (Vec2){
+		.x = edge->fixed_nx < 0 ? 1.0f : 0.0f,
+		.y = edge->fixed_ny < 0 ? 1.0f : 0.0f,
 	};
-	
-	game_state->square.world_position = (Vec3){ .x = 0.0f, .y = 0.0f, .z = 5.0f };
-	game_state->square.scale = 75.0f;
+}
 
-	game_state->camera_world_position = (Vec3){0};
-	game_state->camera_world_orientation = (Mat3x3){0};
+// What triangle setup culling decided to do with a triangle
+typedef enum TriangleCullResult {
+	TRIANGLE_ACCEPT,         // as is
+	TRIANGLE_ACCEPT_FLIPPED, // back facing and not culled, so v1 and v2 need swapping to make it CW
+	TRIANGLE_REJECT,
+} TriangleCullResult;
+
+// v0, v1, v2 are in screen space.
+// Rejects triangles before they ever reach triangle setup and binning: ones facing the way that
+// cull_mode culls, and ones that couldn't cover a pixel anyway, i.e. zero area or falling in
+// between pixel centers.
+// NOTE(mal): Works on the same subpixel snapped positions as the rasterizer's fixed point edge
+// functions, so a triangle is never rejected for being degenerate unless the rasterizer would agree.
+TriangleCullResult cull_triangle(Vertex *v0, Vertex *v1, Vertex *v2, CullMode cull_mode) {
+	int64_t x0 = snap_to_subpixel(v0->position.x), y0 = snap_to_subpixel(v0->position.y);
+	int64_t x1 = snap_to_subpixel(v1->position.x), y1 = snap_to_subpixel(v1->position.y);
+	int64_t x2 = snap_to_subpixel(v2->position.x), y2 = snap_to_subpixel(v2->position.y);
+
+	// The edge function of edge v0 -> v1 evaluated at v2 (see edge_function): twice the signed
+	// area of the triangle, positive if it's CW on screen.
+	int64_t signed_area = (y1 - y0) * (x2 - x0) - (x1 - x0) * (y2 - y0);
+	if (signed_area == 0) {
+		return TRIANGLE_REJECT;
+	}
+	bool is_back_facing = signed_area < 0;
+	if (
+		(cull_mode == CULL_MODE_BACK && is_back_facing) ||
+		(cull_mode == CULL_MODE_FRONT && !is_back_facing)
+	) {
+		return TRIANGLE_REJECT;
+	}
 
-	char *tga_data = (char *)memory->debug_platform_read_entire_file("../testtexture.tga");
-	TGA_Header *tga_header = (TGA_Header *)tga_data;
-	ASSERT(tga_header->bitsperpixel == 32);
-	ASSERT_MSG(tga_header->datatypecode == 2, "Test texture TGA is not RGB!");
-	game_state->texture_height = tga_header->height;
-	game_state->texture_width  = tga_header->width;
-	game_state->texture_pixels = (uint32_t *)(tga_data + sizeof(TGA_Header));
+	// Sample points (pixel centers) are at n * RASTER_SUBPIXEL_STEPS + RASTER_SUBPIXEL_STEPS / 2.
+	// If the first one at or after the triangle's min isn't at or before its max on either axis,
+	// there's nothing for the triangle to cover.
+	int64_t min_x = x0 < x1 ? (x0 < x2 ? x0 : x2) : (x1 < x2 ? x1 : x2);
+	int64_t max_x = x0 > x1 ? (x0 > x2 ? x0 : x2) : (x1 > x2 ? x1 : x2);
+	int64_t min_y = y0 < y1 ? (y0 < y2 ? y0 : y2) : (y1 < y2 ? y1 : y2);
+	int64_t max_y = y0 > y1 ? (y0 > y2 ? y0 : y2) : (y1 > y2 ? y1 : y2);
+	int64_t half_step = RASTER_SUBPIXEL_STEPS / 2;
+	int64_t first_column = (min_x - half_step + RASTER_SUBPIXEL_STEPS - 1) >> RASTER_SUBPIXEL_BITS;
+	int64_t last_column  = (max_x - half_step) >> RASTER_SUBPIXEL_BITS;
+	int64_t first_row    = (min_y - half_step + RASTER_SUBPIXEL_STEPS - 1) >> RASTER_SUBPIXEL_BITS;
+	int64_t last_row     = (max_y - half_step) >> RASTER_SUBPIXEL_BITS;
+	if (first_column > last_column || first_row > last_row) {
+		return TRIANGLE_REJECT;
+	}
 
-	game_state->render_wireframe = 0;
+	TriangleCullResult result = is_back_facing ? TRIANGLE_ACCEPT_FLIPPED : TRIANGLE_ACCEPT;
+	return result;
 }
 
-EXPORT void game_render(GameMemory *memory, GameOffscreenBuffer *offscreen_buffer) {
-	GameState *game_state = (GameState *)memory->storage;
+// v0, v1, v2 are in screen space and in CW order.
+void setup_raster_triangle(RasterTriangle *triangle, Vertex *v0, Vertex *v1, Vertex *v2, float rd0, float rd1, float rd2) {
+	triangle->vertices[0] = *v0;
+	triangle->vertices[1] = *v1;
+	triangle->vertices[2] = *v2;
+	triangle->reciprocal_depth[0] = rd0;
+	triangle->reciprocal_depth[1] = rd1;
+	triangle->reciprocal_depth[2] = rd2;
+
+	Vertex *vs = triangle->vertices;
+
+	// Compute the AABB of the triangle so that we don't have to loop over the entire buffer
+	// every time regardless of the size of the triangle.
+	// TODO(mal): Maybe create to_vec3_max(Vec3 a, Vec3 b) and to_vec3_min(Vec3 a, Vec3 b)
+	// functions and call those here instead?
+	triangle->xmax =
+		vs[0].position.x > vs[1].position.x
+		? (vs[0].position.x > vs[2].position.x ? vs[0].position.x : vs[2].position.x)
+		: (vs[1].position.x > vs[2].position.x ? vs[1].position.x : vs[2].position.x);
+	triangle->xmin =
+		vs[0].position.x < vs[1].position.x
+		? (vs[0].position.x < vs[2].position.x ? vs[0].position.x : vs[2].position.x)
+		: (vs[1].position.x < vs[2].position.x ? vs[1].position.x : vs[2].position.x);
+	triangle->ymax =
+		vs[0].position.y > vs[1].position.y
+		? (vs[0].position.y > vs[2].position.y ? vs[0].position.y : vs[2].position.y)
+		: (vs[1].position.y > vs[2].position.y ? vs[1].position.y : vs[2].position.y);
+	triangle->ymin =
+		vs[0].position.y < vs[1].position.y
+		? (vs[0].position.y < vs[2].position.y ? vs[0].position.y : vs[2].position.y)
+		: (vs[1].position.y < vs[2].position.y ? vs[1].position.y : vs[2].position.y);
+
+	// TODO(mal): Set up for tiled rasterization
+	// https://fileadmin.cs.lth.se/graphics/research/papers/2005/cr/conservative.pdf
+	// Also see "Realtime Rendering" p996
+
+	// Setting up per-edge values
+	// NOTE(mal): The barycentric weight for a given vertex in the triangle is related to
+	// the area of the subtriangle defined by the test point p and the edge OPPOSITE the
+	// given vertex.
+	//
+	// NOTE(mal): Avoiding per-pixel edge function computation. This should be possible because the
+	// edge function is linear. Thus,
+	// E(x + 1, y) = E(x, y) + dY
+	// E(x, y + 1) = E(x, y) - dX
+	// https://www.cs.drexel.edu/~deb39/Classes/Papers/comp175-06-pineda.pdf
+	// Taking the algorithm for stepping from here: https://www.youtube.com/watch?v=k5wtuKWmV48
+	// at chapter "Avoiding Computing the Edge Function Per-Pixel".
+	int32_t vs_fixed[3][2];
+	for (int v_i = 0; v_i < 3; v_i++) {
+		vs_fixed[v_i][0] = snap_to_subpixel(vs[v_i].position.x);
+		vs_fixed[v_i][1] = snap_to_subpixel(vs[v_i].position.y);
+	}
+	setup_triangle_edge(&triangle->edges[0], &vs[1], &vs[2], vs_fixed[1], vs_fixed[2]);
+	setup_triangle_edge(&triangle->edges[1], &vs[2], &vs[0], vs_fixed[2], vs_fixed[0]);
+	setup_triangle_edge(&triangle->edges[2], &vs[0], &vs[1], vs_fixed[0], vs_fixed[1]);
+
+	// Depth gradients, from the plane through the three (x, y, depth) points.
+	float dx1 = vs[1].position.x - vs[0].position.x, dy1 = vs[1].position.y - vs[0].position.y;
+	float dx2 = vs[2].position.x - vs[0].position.x, dy2 = vs[2].position.y - vs[0].position.y;
+	float dz1 = vs[1].position.z - vs[0].position.z, dz2 = vs[2].position.z - vs[0].position.z;
+	float determinant = dx1 * dy2 - dx2 * dy1;
+	triangle->min_depth = fminf(vs[0].position.z, fminf(vs[1].position.z, vs[2].position.z));
+	triangle->max_depth = fmaxf(vs[0].position.z, fmaxf(vs[1].position.z, vs[2].position.z));
+	if (determinant != 0.0f) {
+		triangle->depth_dx = (dz1 * dy2 - dz2 * dy1) / determinant;
+		triangle->depth_dy = (dx1 * dz2 - dx2 * dz1) / determinant;
+	} else {
+		// Degenerate, won't cover any pixels anyway.
+		triangle->depth_dx = 0.0f;
+		triangle->depth_dy = 0.0f;
+	}
+}
 
-	Mat4x4 world_to_opengl_coordinates = {
-		.rows = {
-			[0][0] = 1,
-			[1][1] = 1,
-			[2][2] = -1, // flip z so that +z points out of screen
-			[3][3] = 1,
-		}
-	};
+// Fixed point edge function at the center of pixel (x, y).
+int64_t fixed_edge_function_at_pixel(TriangleEdge *edge, int x, int y) {
+	int64_t sample_x = (int64_t)x * RASTER_SUBPIXEL_STEPS + RASTER_SUBPIXEL_STEPS / 2;
+	int64_t sample_y = (int64_t)y * RASTER_SUBPIXEL_STEPS + RASTER_SUBPIXEL_STEPS / 2;
+	int64_t result = edge->fixed_nx * sample_x + edge->fixed_ny * sample_y + edge->fixed_c;
+	return result;
+}
 
-	//////////////////////////////
-	// CREATING CAMERA_TO_WORLD
-	//////////////////////////////
-	// TODO(mal): Once I swich to using Mat4x4 transforms instead of separate orientations and
-	// position structures, create a mat4x4_inverse function that can calculate what I'm doing below
-	// more efficiently!
-	// NOTE(mal): The inverse of an orthogonal matrix (which rotation matrices are), is the same as
-	// its transpose! (An orthogonal matrix is a square matrix whose rows and coumns are orthonormal
-	// vectors e.g. perpendicual to each other and have a length of one).
-	// Compute orientation inverse R^-1
-	Mat3x3 world_to_camera_orientation = mat3x3_transpose(game_state->camera_world_orientation);
-	// Compute translation inverse t^-1 = -R^-1 * t
-	Vec3 world_to_camera_translation = vec3_negate(mult_mat3x3_vec3(world_to_camera_orientation, game_state->camera_world_position));
-	// NOTE(mal): See "Essential Math" 4.3.6 on p136 for why we compute the above this way.
-	Mat4x4 world_to_camera = {0};
-	// Copying orientation
-	for (int r = 0; r < 3; r++) {
-		for (int c = 0; c < 3; c++) {
-			world_to_camera.rows[r][c] = world_to_camera_orientation.rows[r][c];
-		}
+// NOTE(mal): The tile kernels step the fixed point edge functions in 32 bits. A kernel never steps
+// further than one bin from where it started, and a bin's worth of steps is far smaller than 2^30
+// for any sane screen size, so clamping a value that far from the edge only loses magnitude, never
+// the sign (which is all that coverage cares about).
+#define FIXED_EDGE_VALUE_CLAMP (1 << 30)
+int32_t clamp_fixed_edge_value(int64_t value) {
+	if (value >  FIXED_EDGE_VALUE_CLAMP) value =  FIXED_EDGE_VALUE_CLAMP;
+	if (value < -FIXED_EDGE_VALUE_CLAMP) value = -FIXED_EDGE_VALUE_CLAMP;
+	return (int32_t)value;
+}
+
+// One raster tile's worth of work for a tile kernel.
+typedef struct RasterTile {
+	int min_x, min_y;
+	int max_x, max_y; // exclusive, already clamped to the bin
+	// Edge function values at the center of the tile's top left pixel. The float ones are used for
+	// interpolation and the fixed point ones for coverage.
+	float w0, w1, w2;
+	int32_t fixed_w0, fixed_w1, fixed_w2;
+	// Depth at the center of the tile's top left pixel
+	float depth;
+} RasterTile;
+
+#define RASTER_TILE_FUNCTION_PARAMS (RenderFrame *frame, RasterTriangle *triangle, RasterTile *tile)
+typedef void (*RasterTileFunction) RASTER_TILE_FUNCTION_PARAMS;
+
+// Each kernel body is written once, taking is_full as a compile-time constant, and this generates
+// its two entry points:
+// - rasterize_tile_<name>_full:    the tile was trivially accepted, so every pixel is covered and
+//                                  no edge tests are done at all.
+// - rasterize_tile_<name>_partial: the tile straddles at least one edge, so coverage is tested per
+//                                  pixel.
+#define DEFINE_RASTER_TILE_KERNELS(name, target)\
+	target void rasterize_tile_##name##_full RASTER_TILE_FUNCTION_PARAMS {\
+		rasterize_tile_##name##_body(frame, triangle, tile, true);\
+	}\
+	target void rasterize_tile_##name##_partial RASTER_TILE_FUNCTION_PARAMS {\
+		rasterize_tile_##name##_body(frame, triangle, tile, false);\
 	}
-	// Copying translation
-	world_to_camera.rows[0][3] = world_to_camera_translation.x;
-	world_to_camera.rows[1][3] = world_to_camera_translation.y;
-	world_to_camera.rows[2][3] = world_to_camera_translation.z;
-	world_to_camera.rows[3][3] = 1; // For homogeneous coordinates
 
-	// Translate from world RHS (X+ right, Y+ up, Z+ into) to OpenGL-style RHS
-	world_to_camera = mult_mat4x4_mat4x4(world_to_opengl_coordinates, world_to_camera);
+// NOTE(mal): Clamping the texel coordinates is required for the SIMD kernels since uncovered
+// lanes still compute (garbage) texel coordinates that must not index outside the texture, and
+// it also protects us from pixels right on (or, due to float error, just past) an edge producing
+// u/v == 1.0 or slightly outside of [0, 1].
+uint32_t sample_texture(RenderFrame *frame, float tx_u, float tx_v) {
+	float texel_x = tx_u * frame->texture_width;
+	float texel_y = tx_v * frame->texture_height;
+	if (texel_x < 0.0f) texel_x = 0.0f;
+	if (texel_y < 0.0f) texel_y = 0.0f;
+	if (texel_x > frame->texture_width  - 1) texel_x = frame->texture_width  - 1;
+	if (texel_y > frame->texture_height - 1) texel_y = frame->texture_height - 1;
+	unsigned texel_index = (unsigned)texel_x + (unsigned)texel_y * frame->texture_width;
+	// FIXME(mal): Need to detect machine's endianness and extract the bits
+	// properly. Check the 32-bit color format of TGA (or any other texture
+	// file we may load). I believe it's BGRA.
+	uint32_t texel_tga_color = frame->texture_pixels[texel_index];
+	uint8_t  texel_red       = (texel_tga_color & 0x00FF0000) >> 16;
+	uint8_t  texel_green     = (texel_tga_color & 0x0000FF00) >> 8;
+	uint8_t  texel_blue      = texel_tga_color & 0x000000FF;
+	uint32_t texel_color     = (texel_red << 16) | (texel_green << 8) | texel_blue;
+	return texel_color;
+}
 
-	float vert_fov = DEGREES_TO_RADIANS(90.0f);
-	float near = 1.0f;
-	float far = 200.0f;
-	float aspect_ratio = (float)offscreen_buffer->width / (float)offscreen_buffer->height;
-	// NOTE(mal): d here is the distance from view origin to the plane onto which we're projecting
-	// R3 points down to R2. Its value is really somewhat arbitrary since any point along the view
-	// space z axis will project to the same point on our 2D image plane (given that d > 0... d < 0
-	// will result in a flipped image). However, setting it to the cotangent of half the vertical
-	// fov does mean that any point which intersects at the top/bottom of our view frustum will map
-	// the Y component to 1/-1, which is very convenient for mapping into a unit cube (NDC space)
-	// which we'll use for clipping and eventually conversion to screen space. It just means that we
-	// don't have to do an extra division later to normalize our coordinates to be in the range [-1, 1].
-	// See Essential Math 7.3.5 p246 for this derivation of d.
-	// Another insight: we are solving for d such that the half height of our 2D image plane is 1
-	// unit. This is why we divide our vert_fov in half -- because we're just considering one half of
-	// our Y frustum. Also recall that coordinates in NDC space are in range [-1, 1].
-	float d = (float)(1.0f / tan(vert_fov / 2.0f));
+// The reference implementation. The SIMD kernels below must produce the same image (give or take
+// float rounding on pixels right along edges).
+FORCE_INLINE void rasterize_tile_scalar_body(RenderFrame *frame, RasterTriangle *triangle, RasterTile *tile, const bool is_full) {
+	Vertex *vs = triangle->vertices;
+	float *reciprocal_depth = triangle->reciprocal_depth;
+	float d_w0_col = triangle->edges[0].nx, d_w0_row = triangle->edges[0].ny;
+	float d_w1_col = triangle->edges[1].nx, d_w1_row = triangle->edges[1].ny;
+	float d_w2_col = triangle->edges[2].nx, d_w2_row = triangle->edges[2].ny;
+	int32_t d_fixed_w0_col = triangle->edges[0].fixed_nx * RASTER_SUBPIXEL_STEPS, d_fixed_w0_row = triangle->edges[0].fixed_ny * RASTER_SUBPIXEL_STEPS;
+	int32_t d_fixed_w1_col = triangle->edges[1].fixed_nx * RASTER_SUBPIXEL_STEPS, d_fixed_w1_row = triangle->edges[1].fixed_ny * RASTER_SUBPIXEL_STEPS;
+	int32_t d_fixed_w2_col = triangle->edges[2].fixed_nx * RASTER_SUBPIXEL_STEPS, d_fixed_w2_row = triangle->edges[2].fixed_ny * RASTER_SUBPIXEL_STEPS;
+
+	float w0_row = tile->w0;
+	float w1_row = tile->w1;
+	float w2_row = tile->w2;
+	int32_t fixed_w0_row = tile->fixed_w0;
+	int32_t fixed_w1_row = tile->fixed_w1;
+	int32_t fixed_w2_row = tile->fixed_w2;
+	float depth_row = tile->depth;
+	for (int row = tile->min_y; row < tile->max_y; row++) {
+		float *row_depths = frame->depth_buffer + row * frame->width;
+		float depth = depth_row;
+		float w0 = w0_row;
+		float w1 = w1_row;
+		float w2 = w2_row;
+		int32_t fixed_w0 = fixed_w0_row;
+		int32_t fixed_w1 = fixed_w1_row;
+		int32_t fixed_w2 = fixed_w2_row;
+		for (int col = tile->min_x; col < tile->max_x; col++) {
+			// Inside iff none of the edge functions are negative, i.e. none of their sign bits are set.
+			// Early depth test, so that occluded pixels never get as far as the texture fetch.
+			bool is_covered = is_full || (fixed_w0 | fixed_w1 | fixed_w2) >= 0;
+			bool is_depth_passed = frame->reverse_z ? depth > row_depths[col] : depth < row_depths[col];
+			if (is_covered && is_depth_passed) {
+				row_depths[col] = depth;
+
+				// TODO(mal): Rename some of this stuff. Names are taken from Realtime
+				// Rendering. See p1000 for perspective-correct barycentric interpolation.
+				// I believe here we're essentially foreshortening our barycentric coordinates.
+				float f0 = w0 * reciprocal_depth[0];
+				float f1 = w1 * reciprocal_depth[1];
+				float f2 = w2 * reciprocal_depth[2];
+				float perspective_reciprocal_area = 1.0f / (f0 + f1 + f2);
+
+				// TEXTURING
+				float tx_u = (f0 * vs[0].tx_u + f1 * vs[1].tx_u + f2 * vs[2].tx_u) * perspective_reciprocal_area;
+				float tx_v = (f0 * vs[0].tx_v + f1 * vs[1].tx_v + f2 * vs[2].tx_v) * perspective_reciprocal_area;
+				frame->pixels[col + row * frame->width] = sample_texture(frame, tx_u, tx_v);
+
+				// #define U32_R8(x) (((x) & (0xFF << 16)) >> 16)
+				// #define U32_G8(x) (((x) & (0xFF << 8)) >> 8)
+				// #define U32_B8(x) ((x) & 0xFF)
+				// uint8_t color_red   = (f0 * U32_R8(vs[0].color) + f1 * U32_R8(vs[1].color) + f2 * U32_R8(vs[2].color)) * perspective_reciprocal_area;
+				// uint8_t color_green = (f0 * U32_G8(vs[0].color) + f1 * U32_G8(vs[1].color) + f2 * U32_G8(vs[2].color)) * perspective_reciprocal_area;
+				// uint8_t color_blue  = (f0 * U32_B8(vs[0].color) + f1 * U32_B8(vs[1].color) + f2 * U32_B8(vs[2].color)) * perspective_reciprocal_area;
+				// frame->pixels[col + row * frame->width] =
+				// 	color_red << 16
+				// 	| color_green << 8
+				// 	| color_blue;
 
-	// NOTE(mal): A pure form of the perspective projection matrix just performs a division of x and
-	// y coordinates by z (using perspective divide with w). More useful forms actually will also
-	// scale x,y into NDC range via d and the aspect ratio, and will also remap Z into NDC depth
-	// range via the near and far plane values.
-	// NOTE(mal): If we were not using d and aspect_ratio we would do X component NDC mapping using
-	// left and right values of the frustum planes similar to how we're using near and far.
+			}
 
-	// Set up OpenGL-style perspective transform matrix
-	Mat4x4 perspective = {
-		.rows = {
-			// NOTE(mal): We account for the fact here that pixels aren't necessarily square and that the
-			// horizontal FOV may differ from the vertical FOV.
-			{ d / aspect_ratio, 0, 0,                              0,                                    },
-			{ 0,                d, 0,                              0,                                    },
-			// Map depth [-near, -far] (because we look down -z in RHS view space) to [-1, 1].
-			// NOTE(mal): That this does NOT clip or cull vertices! If a vertex depth < near or depth > far
-			// then it just gets assigned an NDC Z value of -1 or 1, respectively.
-			{ 0,                0, -((far + near) / (far - near)), -((2.0f * far * near) / (far - near)) },
-			{ 0,                0, -1,                             0                                     },
+			depth += triangle->depth_dx;
+			w0 += d_w0_col;
+			w1 += d_w1_col;
+			w2 += d_w2_col;
+			fixed_w0 += d_fixed_w0_col;
+			fixed_w1 += d_fixed_w1_col;
+			fixed_w2 += d_fixed_w2_col;
 		}
-	};
 
-	// NDC ranges from [-1, -1] to [1, 1]
-	// We want to map to our screen, which is from [0, 0] to [width, height], and where +y is down
+		depth_row += triangle->depth_dy;
+		w0_row += d_w0_row;
+		w1_row += d_w1_row;
+		w2_row += d_w2_row;
+		fixed_w0_row += d_fixed_w0_row;
+		fixed_w1_row += d_fixed_w1_row;
+		fixed_w2_row += d_fixed_w2_row;
+	}
+}
+DEFINE_RASTER_TILE_KERNELS(scalar, )
+
+// Coverage only, for the watertightness test: counts how many triangles cover each pixel.
+FORCE_INLINE void rasterize_tile_overdraw_body(RenderFrame *frame, RasterTriangle *triangle, RasterTile *tile, const bool is_full) {
+	int32_t d_fixed_w0_col = triangle->edges[0].fixed_nx * RASTER_SUBPIXEL_STEPS, d_fixed_w0_row = triangle->edges[0].fixed_ny * RASTER_SUBPIXEL_STEPS;
+	int32_t d_fixed_w1_col = triangle->edges[1].fixed_nx * RASTER_SUBPIXEL_STEPS, d_fixed_w1_row = triangle->edges[1].fixed_ny * RASTER_SUBPIXEL_STEPS;
+	int32_t d_fixed_w2_col = triangle->edges[2].fixed_nx * RASTER_SUBPIXEL_STEPS, d_fixed_w2_row = triangle->edges[2].fixed_ny * RASTER_SUBPIXEL_STEPS;
+
+	int32_t fixed_w0_row = tile->fixed_w0;
+	int32_t fixed_w1_row = tile->fixed_w1;
+	int32_t fixed_w2_row = tile->fixed_w2;
+	for (int row = tile->min_y; row < tile->max_y; row++) {
+		int32_t fixed_w0 = fixed_w0_row;
+		int32_t fixed_w1 = fixed_w1_row;
+		int32_t fixed_w2 = fixed_w2_row;
+		for (int col = tile->min_x; col < tile->max_x; col++) {
+			if (is_full || (fixed_w0 | fixed_w1 | fixed_w2) >= 0) {
+				uint8_t *count = &frame->overdraw_counts[col + row * frame->width];
+				if (*count < UINT8_MAX) (*count)++;
+			}
+			fixed_w0 += d_fixed_w0_col;
+			fixed_w1 += d_fixed_w1_col;
+			fixed_w2 += d_fixed_w2_col;
+		}
+		fixed_w0_row += d_fixed_w0_row;
+		fixed_w1_row += d_fixed_w1_row;
+		fixed_w2_row += d_fixed_w2_row;
+	}
+}
+DEFINE_RASTER_TILE_KERNELS(overdraw, )
 
-	float half_width = offscreen_buffer->width / 2.0f;
-	float half_height = offscreen_buffer->height / 2.0f;
-	float screen_offset_x = 0.0f;
-	float screen_offset_y = 0.0f;
-	// z is a special case since we want to use it for depth testing later.
-	// We want it to range from [0, depth] where depth usually = 1.
-	float depth = 1.0f;
-	float half_depth = depth / 2;
-	Mat4x4 ndc_to_screen = {
-		.rows = {
-			{ half_width, 0,            0,          half_width + screen_offset_x  },
-			{ 0,          -half_height, 0,          half_height + screen_offset_y },
-			{ 0,          0,            half_depth, half_depth                    },
-			{ 0,          0,            0,          1                             },
+uint16_t pack_unorm16(float value) {
+	if (value < 0.0f) value = 0.0f;
+	if (value > 1.0f) value = 1.0f;
+	uint16_t result = (uint16_t)(value * 65535.0f + 0.5f);
+	return result;
+}
+
+// Visibility buffer mode: same coverage and depth test as rasterize_tile_scalar_body, but instead of
+// texturing it only records the triangle and its perspective correct barycentrics.
+// NOTE(mal): There's only a scalar version of this since the texturing that the SIMD kernels are
+// there to speed up is exactly what this skips.
+FORCE_INLINE void rasterize_tile_visibility_body(RenderFrame *frame, RasterTriangle *triangle, RasterTile *tile, const bool is_full) {
+	float *reciprocal_depth = triangle->reciprocal_depth;
+	uint32_t triangle_index = (uint32_t)(triangle - frame->triangles);
+	float d_w0_col = triangle->edges[0].nx, d_w0_row = triangle->edges[0].ny;
+	float d_w1_col = triangle->edges[1].nx, d_w1_row = triangle->edges[1].ny;
+	float d_w2_col = triangle->edges[2].nx, d_w2_row = triangle->edges[2].ny;
+	int32_t d_fixed_w0_col = triangle->edges[0].fixed_nx * RASTER_SUBPIXEL_STEPS, d_fixed_w0_row = triangle->edges[0].fixed_ny * RASTER_SUBPIXEL_STEPS;
+	int32_t d_fixed_w1_col = triangle->edges[1].fixed_nx * RASTER_SUBPIXEL_STEPS, d_fixed_w1_row = triangle->edges[1].fixed_ny * RASTER_SUBPIXEL_STEPS;
+	int32_t d_fixed_w2_col = triangle->edges[2].fixed_nx * RASTER_SUBPIXEL_STEPS, d_fixed_w2_row = triangle->edges[2].fixed_ny * RASTER_SUBPIXEL_STEPS;
+
+	float w0_row = tile->w0;
+	float w1_row = tile->w1;
+	float w2_row = tile->w2;
+	int32_t fixed_w0_row = tile->fixed_w0;
+	int32_t fixed_w1_row = tile->fixed_w1;
+	int32_t fixed_w2_row = tile->fixed_w2;
+	float depth_row = tile->depth;
+	for (int row = tile->min_y; row < tile->max_y; row++) {
+		float *row_depths = frame->depth_buffer + row * frame->width;
+		VisibilitySample *row_samples = frame->visibility_buffer + row * frame->width;
+		float depth = depth_row;
+		float w0 = w0_row;
+		float w1 = w1_row;
+		float w2 = w2_row;
+		int32_t fixed_w0 = fixed_w0_row;
+		int32_t fixed_w1 = fixed_w1_row;
+		int32_t fixed_w2 = fixed_w2_row;
+		for (int col = tile->min_x; col < tile->max_x; col++) {
+			bool is_covered = is_full || (fixed_w0 | fixed_w1 | fixed_w2) >= 0;
+			bool is_depth_passed = frame->reverse_z ? depth > row_depths[col] : depth < row_depths[col];
+			if (is_covered && is_depth_passed) {
+				row_depths[col] = depth;
+
+				float f0 = w0 * reciprocal_depth[0];
+				float f1 = w1 * reciprocal_depth[1];
+				float f2 = w2 * reciprocal_depth[2];
+				float perspective_reciprocal_area = 1.0f / (f0 + f1 + f2);
+				row_samples[col] = (VisibilitySample){
+					.triangle_index = triangle_index,
+					.b1 = pack_unorm16(f1 * perspective_reciprocal_area),
+					.b2 = pack_unorm16(f2 * perspective_reciprocal_area),
+				};
+			}
+
+			depth += triangle->depth_dx;
+			w0 += d_w0_col;
+			w1 += d_w1_col;
+			w2 += d_w2_col;
+			fixed_w0 += d_fixed_w0_col;
+			fixed_w1 += d_fixed_w1_col;
+			fixed_w2 += d_fixed_w2_col;
 		}
-	};
 
-	uint32_t *pixels = (uint32_t *)offscreen_buffer->memory;
+		depth_row += triangle->depth_dy;
+		w0_row += d_w0_row;
+		w1_row += d_w1_row;
+		w2_row += d_w2_row;
+		fixed_w0_row += d_fixed_w0_row;
+		fixed_w1_row += d_fixed_w1_row;
+		fixed_w2_row += d_fixed_w2_row;
+	}
+}
+DEFINE_RASTER_TILE_KERNELS(visibility, )
+
+#ifdef RASTER_SIMD_X64
+// Processes the tile in 4x1 pixel blocks. Each lane evaluates the three edge functions, the
+// perspective-correct weights and the texel for one pixel, then the covered lanes are written with
+// a masked store.
+FORCE_INLINE void rasterize_tile_sse2_body(RenderFrame *frame, RasterTriangle *triangle, RasterTile *tile, const bool is_full) {
+	Vertex *vs = triangle->vertices;
+	TriangleEdge *e0 = &triangle->edges[0];
+	TriangleEdge *e1 = &triangle->edges[1];
+	TriangleEdge *e2 = &triangle->edges[2];
+
+	const __m128 zero         = _mm_setzero_ps();
+	const __m128 one          = _mm_set1_ps(1.0f);
+	const __m128 all_lanes    = _mm_castsi128_ps(_mm_set1_epi32(-1));
+	const __m128 lane_offsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+
+	// Per-lane starting offsets from the first pixel in the block, and the steps for moving one
+	// block to the right.
+	const __m128 w0_lane_offsets = _mm_mul_ps(lane_offsets, _mm_set1_ps(e0->nx));
+	const __m128 w1_lane_offsets = _mm_mul_ps(lane_offsets, _mm_set1_ps(e1->nx));
+	const __m128 w2_lane_offsets = _mm_mul_ps(lane_offsets, _mm_set1_ps(e2->nx));
+	const __m128 d_w0_block = _mm_set1_ps(4.0f * e0->nx);
+	const __m128 d_w1_block = _mm_set1_ps(4.0f * e1->nx);
+	const __m128 d_w2_block = _mm_set1_ps(4.0f * e2->nx);
+
+	// Same for the fixed point edge functions used for coverage.
+	// NOTE(mal): SSE2 has no 32-bit integer multiply, so the lane offsets are built by hand.
+	const int32_t fixed_w0_col = e0->fixed_nx * RASTER_SUBPIXEL_STEPS;
+	const int32_t fixed_w1_col = e1->fixed_nx * RASTER_SUBPIXEL_STEPS;
+	const int32_t fixed_w2_col = e2->fixed_nx * RASTER_SUBPIXEL_STEPS;
+	const __m128i fixed_w0_lane_offsets = _mm_setr_epi32(0, fixed_w0_col, 2 * fixed_w0_col, 3 * fixed_w0_col);
+	const __m128i fixed_w1_lane_offsets = _mm_setr_epi32(0, fixed_w1_col, 2 * fixed_w1_col, 3 * fixed_w1_col);
+	const __m128i fixed_w2_lane_offsets = _mm_setr_epi32(0, fixed_w2_col, 2 * fixed_w2_col, 3 * fixed_w2_col);
+	const __m128i d_fixed_w0_block = _mm_set1_epi32(4 * fixed_w0_col);
+	const __m128i d_fixed_w1_block = _mm_set1_epi32(4 * fixed_w1_col);
+	const __m128i d_fixed_w2_block = _mm_set1_epi32(4 * fixed_w2_col);
+	const __m128i minus_one        = _mm_set1_epi32(-1);
+
+	const __m128 depth_lane_offsets = _mm_mul_ps(lane_offsets, _mm_set1_ps(triangle->depth_dx));
+	const __m128 d_depth_block      = _mm_set1_ps(4.0f * triangle->depth_dx);
+
+	const __m128 rd0 = _mm_set1_ps(triangle->reciprocal_depth[0]);
+	const __m128 rd1 = _mm_set1_ps(triangle->reciprocal_depth[1]);
+	const __m128 rd2 = _mm_set1_ps(triangle->reciprocal_depth[2]);
+	const __m128 u0 = _mm_set1_ps(vs[0].tx_u), v0 = _mm_set1_ps(vs[0].tx_v);
+	const __m128 u1 = _mm_set1_ps(vs[1].tx_u), v1 = _mm_set1_ps(vs[1].tx_v);
+	const __m128 u2 = _mm_set1_ps(vs[2].tx_u), v2 = _mm_set1_ps(vs[2].tx_v);
+
+	const __m128  texture_width   = _mm_set1_ps((float)frame->texture_width);
+	const __m128  texture_height  = _mm_set1_ps((float)frame->texture_height);
+	const __m128  texel_x_max     = _mm_set1_ps((float)(frame->texture_width  - 1));
+	const __m128  texel_y_max     = _mm_set1_ps((float)(frame->texture_height - 1));
+	const __m128i texel_rgb_mask  = _mm_set1_epi32(0x00FFFFFF);
+	const uint32_t *texture_pixels = frame->texture_pixels;
+
+	float w0_row = tile->w0;
+	float w1_row = tile->w1;
+	float w2_row = tile->w2;
+	int32_t fixed_w0_row = tile->fixed_w0;
+	int32_t fixed_w1_row = tile->fixed_w1;
+	int32_t fixed_w2_row = tile->fixed_w2;
+	float depth_row = tile->depth;
+	for (int row = tile->min_y; row < tile->max_y; row++) {
+		uint32_t *row_pixels = frame->pixels + row * frame->width;
+		float    *row_depths = frame->depth_buffer + row * frame->width;
+		__m128 depth = _mm_add_ps(_mm_set1_ps(depth_row), depth_lane_offsets);
+		__m128 w0 = _mm_add_ps(_mm_set1_ps(w0_row), w0_lane_offsets);
+		__m128 w1 = _mm_add_ps(_mm_set1_ps(w1_row), w1_lane_offsets);
+		__m128 w2 = _mm_add_ps(_mm_set1_ps(w2_row), w2_lane_offsets);
+		__m128i fixed_w0 = _mm_add_epi32(_mm_set1_epi32(fixed_w0_row), fixed_w0_lane_offsets);
+		__m128i fixed_w1 = _mm_add_epi32(_mm_set1_epi32(fixed_w1_row), fixed_w1_lane_offsets);
+		__m128i fixed_w2 = _mm_add_epi32(_mm_set1_epi32(fixed_w2_row), fixed_w2_lane_offsets);
+
+		for (int col = tile->min_x; col < tile->max_x; col += 4) {
+			__m128 coverage = all_lanes;
+			if (!is_full) {
+				// Inside iff none of the edge functions' sign bits are set.
+				__m128i any_negative = _mm_or_si128(_mm_or_si128(fixed_w0, fixed_w1), fixed_w2);
+				coverage = _mm_castsi128_ps(_mm_cmpgt_epi32(any_negative, minus_one));
+			}
+			int remaining = tile->max_x - col;
+			if (remaining < 4) {
+				coverage = _mm_and_ps(coverage, _mm_cmplt_ps(lane_offsets, _mm_set1_ps((float)remaining)));
+			}
 
-	// NOTE(mal): MUST be powers of 2!
-	const int RASTER_TILE_WIDTH  = 16;
-	const int RASTER_TILE_HEIGHT = 16;
-	#define CLEAR_COLOR 0x00000000
-	#define RASTER_TILE_COLOR 0x00440011
-	for (int r = 0; r < offscreen_buffer->height; r++) {
-		const int row_offset = r * offscreen_buffer->width;
-		for (int c = 0; c < offscreen_buffer->width; c++) {
-			uint32_t *pixel = &pixels[c + row_offset];
-			*pixel = CLEAR_COLOR;
-			if (game_state->render_raster_tile_state == RENDER_RASTER_TILES_BELOW) {
-				if (!(c & (RASTER_TILE_WIDTH - 1)) || !(r & (RASTER_TILE_HEIGHT - 1))) {
-					*pixel = RASTER_TILE_COLOR;
+			// Early depth test, so that occluded pixels never get as far as the texture fetch.
+			__m128 stored_depth;
+			if (remaining >= 4) {
+				stored_depth = _mm_loadu_ps(row_depths + col);
+			} else {
+				float block_depths[4] = {0};
+				for (int lane = 0; lane < remaining; lane++) block_depths[lane] = row_depths[col + lane];
+				stored_depth = _mm_loadu_ps(block_depths);
+			}
+			__m128 depth_passed = frame->reverse_z ? _mm_cmpgt_ps(depth, stored_depth) : _mm_cmplt_ps(depth, stored_depth);
+			__m128 write_mask = _mm_and_ps(coverage, depth_passed);
+
+			int write_bits = _mm_movemask_ps(write_mask);
+			if (write_bits) {
+				__m128 f0 = _mm_mul_ps(w0, rd0);
+				__m128 f1 = _mm_mul_ps(w1, rd1);
+				__m128 f2 = _mm_mul_ps(w2, rd2);
+				__m128 perspective_reciprocal_area = _mm_div_ps(one, _mm_add_ps(_mm_add_ps(f0, f1), f2));
+
+				// TEXTURING
+				__m128 tx_u = _mm_mul_ps(
+					_mm_add_ps(_mm_add_ps(_mm_mul_ps(f0, u0), _mm_mul_ps(f1, u1)), _mm_mul_ps(f2, u2)),
+					perspective_reciprocal_area
+				);
+				__m128 tx_v = _mm_mul_ps(
+					_mm_add_ps(_mm_add_ps(_mm_mul_ps(f0, v0), _mm_mul_ps(f1, v1)), _mm_mul_ps(f2, v2)),
+					perspective_reciprocal_area
+				);
+				__m128 texel_x = _mm_min_ps(_mm_max_ps(_mm_mul_ps(tx_u, texture_width),  zero), texel_x_max);
+				__m128 texel_y = _mm_min_ps(_mm_max_ps(_mm_mul_ps(tx_v, texture_height), zero), texel_y_max);
+				texel_x = _mm_cvtepi32_ps(_mm_cvttps_epi32(texel_x));
+				texel_y = _mm_cvtepi32_ps(_mm_cvttps_epi32(texel_y));
+				// NOTE(mal): SSE2 has no 32-bit integer multiply, so the index is computed in float.
+				// That's exact as long as the texture has fewer than 2^24 texels.
+				__m128i texel_index = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(texel_y, texture_width), texel_x));
+
+				// NOTE(mal): No gather instruction before AVX2, so fetch the texels one lane at a time.
+				uint32_t texel_indices[4];
+				_mm_storeu_si128((__m128i *)texel_indices, texel_index);
+				__m128i texels = _mm_setr_epi32(
+					texture_pixels[texel_indices[0]], texture_pixels[texel_indices[1]],
+					texture_pixels[texel_indices[2]], texture_pixels[texel_indices[3]]
+				);
+				texels = _mm_and_si128(texels, texel_rgb_mask);
+
+				__m128i write_mask_i = _mm_castps_si128(write_mask);
+				if (write_bits == 0xF) {
+					_mm_storeu_si128((__m128i *)(row_pixels + col), texels);
+					_mm_storeu_ps(row_depths + col, depth);
+				} else if (remaining >= 4) {
+					__m128i dest   = _mm_loadu_si128((__m128i *)(row_pixels + col));
+					__m128i result = _mm_or_si128(_mm_and_si128(write_mask_i, texels), _mm_andnot_si128(write_mask_i, dest));
+					_mm_storeu_si128((__m128i *)(row_pixels + col), result);
+					_mm_storeu_ps(row_depths + col, _mm_or_ps(_mm_and_ps(write_mask, depth), _mm_andnot_ps(write_mask, stored_depth)));
+				} else {
+					// The row ends partway through this block. Don't touch anything past the end.
+					uint32_t block_texels[4];
+					float    block_depths[4];
+					_mm_storeu_si128((__m128i *)block_texels, texels);
+					_mm_storeu_ps(block_depths, depth);
+					for (int lane = 0; lane < remaining; lane++) {
+						if (write_bits & (1 << lane)) {
+							row_pixels[col + lane] = block_texels[lane];
+							row_depths[col + lane] = block_depths[lane];
+						}
+					}
 				}
 			}
+
+			depth = _mm_add_ps(depth, d_depth_block);
+			w0 = _mm_add_ps(w0, d_w0_block);
+			w1 = _mm_add_ps(w1, d_w1_block);
+			w2 = _mm_add_ps(w2, d_w2_block);
+			fixed_w0 = _mm_add_epi32(fixed_w0, d_fixed_w0_block);
+			fixed_w1 = _mm_add_epi32(fixed_w1, d_fixed_w1_block);
+			fixed_w2 = _mm_add_epi32(fixed_w2, d_fixed_w2_block);
 		}
+
+		depth_row += triangle->depth_dy;
+		w0_row += e0->ny;
+		w1_row += e1->ny;
+		w2_row += e2->ny;
+		fixed_w0_row += e0->fixed_ny * RASTER_SUBPIXEL_STEPS;
+		fixed_w1_row += e1->fixed_ny * RASTER_SUBPIXEL_STEPS;
+		fixed_w2_row += e2->fixed_ny * RASTER_SUBPIXEL_STEPS;
 	}
+}
+DEFINE_RASTER_TILE_KERNELS(sse2, )
+
+// Same as rasterize_tile_sse2_body but in 8x1 pixel blocks, using a hardware gather for the texel
+// fetches and masked loads/stores (which never touch masked-off lanes, so the end of a row needs no
+// special handling).
+FORCE_INLINE TARGET_AVX2 void rasterize_tile_avx2_body(RenderFrame *frame, RasterTriangle *triangle, RasterTile *tile, const bool is_full) {
+	Vertex *vs = triangle->vertices;
+	TriangleEdge *e0 = &triangle->edges[0];
+	TriangleEdge *e1 = &triangle->edges[1];
+	TriangleEdge *e2 = &triangle->edges[2];
+
+	const __m256  zero         = _mm256_setzero_ps();
+	const __m256  one          = _mm256_set1_ps(1.0f);
+	const __m256  all_lanes    = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+	const __m256  lane_offsets = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+
+	const __m256 w0_lane_offsets = _mm256_mul_ps(lane_offsets, _mm256_set1_ps(e0->nx));
+	const __m256 w1_lane_offsets = _mm256_mul_ps(lane_offsets, _mm256_set1_ps(e1->nx));
+	const __m256 w2_lane_offsets = _mm256_mul_ps(lane_offsets, _mm256_set1_ps(e2->nx));
+	const __m256 d_w0_block = _mm256_set1_ps(8.0f * e0->nx);
+	const __m256 d_w1_block = _mm256_set1_ps(8.0f * e1->nx);
+	const __m256 d_w2_block = _mm256_set1_ps(8.0f * e2->nx);
+
+	const __m256i lane_indices = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i fixed_w0_lane_offsets = _mm256_mullo_epi32(lane_indices, _mm256_set1_epi32(e0->fixed_nx * RASTER_SUBPIXEL_STEPS));
+	const __m256i fixed_w1_lane_offsets = _mm256_mullo_epi32(lane_indices, _mm256_set1_epi32(e1->fixed_nx * RASTER_SUBPIXEL_STEPS));
+	const __m256i fixed_w2_lane_offsets = _mm256_mullo_epi32(lane_indices, _mm256_set1_epi32(e2->fixed_nx * RASTER_SUBPIXEL_STEPS));
+	const __m256i d_fixed_w0_block = _mm256_set1_epi32(8 * (e0->fixed_nx * RASTER_SUBPIXEL_STEPS));
+	const __m256i d_fixed_w1_block = _mm256_set1_epi32(8 * (e1->fixed_nx * RASTER_SUBPIXEL_STEPS));
+	const __m256i d_fixed_w2_block = _mm256_set1_epi32(8 * (e2->fixed_nx * RASTER_SUBPIXEL_STEPS));
+	const __m256i minus_one        = _mm256_set1_epi32(-1);
+
+	const __m256 depth_lane_offsets = _mm256_mul_ps(lane_offsets, _mm256_set1_ps(triangle->depth_dx));
+	const __m256 d_depth_block      = _mm256_set1_ps(8.0f * triangle->depth_dx);
+
+	const __m256 rd0 = _mm256_set1_ps(triangle->reciprocal_depth[0]);
+	const __m256 rd1 = _mm256_set1_ps(triangle->reciprocal_depth[1]);
+	const __m256 rd2 = _mm256_set1_ps(triangle->reciprocal_depth[2]);
+	const __m256 u0 = _mm256_set1_ps(vs[0].tx_u), v0 = _mm256_set1_ps(vs[0].tx_v);
+	const __m256 u1 = _mm256_set1_ps(vs[1].tx_u), v1 = _mm256_set1_ps(vs[1].tx_v);
+	const __m256 u2 = _mm256_set1_ps(vs[2].tx_u), v2 = _mm256_set1_ps(vs[2].tx_v);
+
+	const __m256  texture_width      = _mm256_set1_ps((float)frame->texture_width);
+	const __m256  texture_height     = _mm256_set1_ps((float)frame->texture_height);
+	const __m256  texel_x_max        = _mm256_set1_ps((float)(frame->texture_width  - 1));
+	const __m256  texel_y_max        = _mm256_set1_ps((float)(frame->texture_height - 1));
+	const __m256i texture_width_i    = _mm256_set1_epi32((int)frame->texture_width);
+	const __m256i texel_rgb_mask     = _mm256_set1_epi32(0x00FFFFFF);
+	const int    *texture_pixels     = (const int *)frame->texture_pixels;
+
+	float w0_row = tile->w0;
+	float w1_row = tile->w1;
+	float w2_row = tile->w2;
+	int32_t fixed_w0_row = tile->fixed_w0;
+	int32_t fixed_w1_row = tile->fixed_w1;
+	int32_t fixed_w2_row = tile->fixed_w2;
+	float depth_row = tile->depth;
+	for (int row = tile->min_y; row < tile->max_y; row++) {
+		uint32_t *row_pixels = frame->pixels + row * frame->width;
+		float    *row_depths = frame->depth_buffer + row * frame->width;
+		__m256 depth = _mm256_add_ps(_mm256_set1_ps(depth_row), depth_lane_offsets);
+		__m256 w0 = _mm256_add_ps(_mm256_set1_ps(w0_row), w0_lane_offsets);
+		__m256 w1 = _mm256_add_ps(_mm256_set1_ps(w1_row), w1_lane_offsets);
+		__m256 w2 = _mm256_add_ps(_mm256_set1_ps(w2_row), w2_lane_offsets);
+		__m256i fixed_w0 = _mm256_add_epi32(_mm256_set1_epi32(fixed_w0_row), fixed_w0_lane_offsets);
+		__m256i fixed_w1 = _mm256_add_epi32(_mm256_set1_epi32(fixed_w1_row), fixed_w1_lane_offsets);
+		__m256i fixed_w2 = _mm256_add_epi32(_mm256_set1_epi32(fixed_w2_row), fixed_w2_lane_offsets);
+
+		for (int col = tile->min_x; col < tile->max_x; col += 8) {
+			__m256 coverage = all_lanes;
+			if (!is_full) {
+				__m256i any_negative = _mm256_or_si256(_mm256_or_si256(fixed_w0, fixed_w1), fixed_w2);
+				coverage = _mm256_castsi256_ps(_mm256_cmpgt_epi32(any_negative, minus_one));
+			}
+			int remaining = tile->max_x - col;
+			if (remaining < 8) {
+				coverage = _mm256_and_ps(coverage, _mm256_cmp_ps(lane_offsets, _mm256_set1_ps((float)remaining), _CMP_LT_OQ));
+			}
 
-	// FIXME(mal): Just construct/use/whatever a 4x4 transformation matrix for local_to_world
-	Vertex transformed_vertices[4]; // for the quad, will need to use dynamic mem management for
-									// actual stuff
-	{
-		float r = DEGREES_TO_RADIANS(game_state->rotation_y_degrees);
-		float sin_r = sin(r), cos_r = cos(r);
-		for (int v_i = 0; v_i < 4; v_i++) {
-			Vertex v = game_state->square.local_vertices[v_i];
+			// Early depth test, so that occluded pixels never get as far as the texture fetch. The
+			// masked load doesn't touch lanes past the end of the row.
+			__m256 stored_depth = _mm256_maskload_ps(row_depths + col, _mm256_castps_si256(coverage));
+			__m256 depth_passed = frame->reverse_z
+				? _mm256_cmp_ps(depth, stored_depth, _CMP_GT_OQ)
+				: _mm256_cmp_ps(depth, stored_depth, _CMP_LT_OQ);
+			__m256 write_mask = _mm256_and_ps(coverage, depth_passed);
+
+			int write_bits = _mm256_movemask_ps(write_mask);
+			if (write_bits) {
+				__m256 f0 = _mm256_mul_ps(w0, rd0);
+				__m256 f1 = _mm256_mul_ps(w1, rd1);
+				__m256 f2 = _mm256_mul_ps(w2, rd2);
+				__m256 perspective_reciprocal_area = _mm256_div_ps(one, _mm256_add_ps(_mm256_add_ps(f0, f1), f2));
+
+				// TEXTURING
+				__m256 tx_u = _mm256_mul_ps(
+					_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(f0, u0), _mm256_mul_ps(f1, u1)), _mm256_mul_ps(f2, u2)),
+					perspective_reciprocal_area
+				);
+				__m256 tx_v = _mm256_mul_ps(
+					_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(f0, v0), _mm256_mul_ps(f1, v1)), _mm256_mul_ps(f2, v2)),
+					perspective_reciprocal_area
+				);
+				__m256 texel_x = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(tx_u, texture_width),  zero), texel_x_max);
+				__m256 texel_y = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(tx_v, texture_height), zero), texel_y_max);
+				__m256i texel_index = _mm256_add_epi32(
+					_mm256_mullo_epi32(_mm256_cvttps_epi32(texel_y), texture_width_i),
+					_mm256_cvttps_epi32(texel_x)
+				);
+
+				__m256i write_mask_i = _mm256_castps_si256(write_mask);
+				if (write_bits == 0xFF) {
+					// Every lane is written, so no masking on either the gather or the stores.
+					__m256i texels = _mm256_i32gather_epi32(texture_pixels, texel_index, sizeof(uint32_t));
+					texels = _mm256_and_si256(texels, texel_rgb_mask);
+					_mm256_storeu_si256((__m256i *)(row_pixels + col), texels);
+					_mm256_storeu_ps(row_depths + col, depth);
+				} else {
+					__m256i texels = _mm256_mask_i32gather_epi32(
+						_mm256_setzero_si256(), texture_pixels, texel_index, write_mask_i, sizeof(uint32_t)
+					);
+					texels = _mm256_and_si256(texels, texel_rgb_mask);
+					_mm256_maskstore_epi32((int *)(row_pixels + col), write_mask_i, texels);
+					_mm256_maskstore_ps(row_depths + col, write_mask_i, depth);
+				}
+			}
 
-			// Scaling
-			for (int i = 0; i < 3; i++) v.position.elements[i] *= game_state->square.scale;
-			// Rotating about Y axis
-			float x = v.position.x, z = v.position.z;
-			v.position.x = z*sin_r + x*cos_r;
-			v.position.z = z*cos_r - x*sin_r;
-			// Translating
-			for (int i = 0; i < 3; i++) v.position.elements[i] += game_state->square.world_position.elements[i];
-			// world --> view --> homogeneous clip
-			v.position = mult_mat4x4_vec4(perspective, mult_mat4x4_vec4(world_to_camera, v.position));
+			depth = _mm256_add_ps(depth, d_depth_block);
+			w0 = _mm256_add_ps(w0, d_w0_block);
+			w1 = _mm256_add_ps(w1, d_w1_block);
+			w2 = _mm256_add_ps(w2, d_w2_block);
+			fixed_w0 = _mm256_add_epi32(fixed_w0, d_fixed_w0_block);
+			fixed_w1 = _mm256_add_epi32(fixed_w1, d_fixed_w1_block);
+			fixed_w2 = _mm256_add_epi32(fixed_w2, d_fixed_w2_block);
+		}
 
-			transformed_vertices[v_i] = v;
+		depth_row += triangle->depth_dy;
+		w0_row += e0->ny;
+		w1_row += e1->ny;
+		w2_row += e2->ny;
+		fixed_w0_row += e0->fixed_ny * RASTER_SUBPIXEL_STEPS;
+		fixed_w1_row += e1->fixed_ny * RASTER_SUBPIXEL_STEPS;
+		fixed_w2_row += e2->fixed_ny * RASTER_SUBPIXEL_STEPS;
+	}
+}
+DEFINE_RASTER_TILE_KERNELS(avx2, TARGET_AVX2)
+#endif
+
+// Indexed by [RasterKernel][is tile fully inside the triangle]
+RasterTileFunction raster_tile_functions[RASTER_KERNEL_COUNT][2] = {
+	[RASTER_KERNEL_SCALAR] = { rasterize_tile_scalar_partial, rasterize_tile_scalar_full },
+#ifdef RASTER_SIMD_X64
+	[RASTER_KERNEL_SSE2]   = { rasterize_tile_sse2_partial,   rasterize_tile_sse2_full   },
+	[RASTER_KERNEL_AVX2]   = { rasterize_tile_avx2_partial,   rasterize_tile_avx2_full   },
+#endif
+};
+RasterTileFunction overdraw_tile_functions[2] = { rasterize_tile_overdraw_partial, rasterize_tile_overdraw_full };
+RasterTileFunction visibility_tile_functions[2] = { rasterize_tile_visibility_partial, rasterize_tile_visibility_full };
+
+typedef enum TileCoverage {
+	TILE_COVERAGE_NONE,    // fully outside at least one edge
+	TILE_COVERAGE_PARTIAL, // straddles at least one edge
+	TILE_COVERAGE_FULL,    // fully inside all three edges
+} TileCoverage;
+
+// Trivial reject/accept test for the rectangle [min, min + size), used at every level of the tile
+// hierarchy. A tile is fully outside an edge if its most inside pixel is outside the edge, and
+// fully inside an edge if its most outside pixel is inside the edge.
+// NOTE(mal): Since this uses the same exact fixed point edge functions (evaluated at the corner
+// pixels' centers) as the per-pixel tests, a trivially accepted/rejected tile gets exactly the
+// coverage that testing every one of its pixels would have given it.
+TileCoverage classify_tile(RasterTriangle *triangle, int min_x, int min_y, int width, int height) {
+	bool is_fully_inside_triangle = true;
+	for (int e_i = 0; e_i < 3; e_i++) {
+		TriangleEdge *e = &triangle->edges[e_i];
+		int64_t most_inside = fixed_edge_function_at_pixel(
+			e,
+			min_x + (int)e->tile_offset_most_inside.x * (width  - 1),
+			min_y + (int)e->tile_offset_most_inside.y * (height - 1)
+		);
+		if (most_inside < 0) {
+			return TILE_COVERAGE_NONE;
 		}
+		int64_t most_outside = fixed_edge_function_at_pixel(
+			e,
+			min_x + (int)e->tile_offset_most_outside.x * (width  - 1),
+			min_y + (int)e->tile_offset_most_outside.y * (height - 1)
+		);
+		is_fully_inside_triangle &= most_outside >= 0;
 	}
+	return is_fully_inside_triangle ? TILE_COVERAGE_FULL : TILE_COVERAGE_PARTIAL;
+}
 
-	//////////////////////////////
-	// BEGIN CLIPPING
-	//////////////////////////////
-	// Feed the entire polygon through the clipping pipeline rather
-	// than clipping individual triangles within the polygon.
-	// This will ensure that positions of vertices that create shared
-	// edges in the output triangle fan will always be identical, thus
-	// ensuring that no under- or over-draw will occur (provided our
-	// edge constant bias is set up properly).
-
-	// NOTE(mal): I believe that each plane can add at most one generated vertex, which means
-	// that if we start with 4 and clip against 6 frustum planes then we will end up with at
-	// most 10 vertices (TODO figure out number of triangles generated with 10 vertices in triangle
-	// fan configuration)
-	Vertex clip_buffer_a[10] = {
-		transformed_vertices[0],
-		transformed_vertices[1],
-		transformed_vertices[2],
-		transformed_vertices[3]
+RasterTile make_raster_tile(RasterTriangle *triangle, int min_x, int min_y, int max_x, int max_y) {
+	TriangleEdge *e0 = &triangle->edges[0]; // v1v2
+	TriangleEdge *e1 = &triangle->edges[1]; // v2v0
+	TriangleEdge *e2 = &triangle->edges[2]; // v0v1
+	RasterTile result = {
+		.min_x = min_x,
+		.min_y = min_y,
+		.max_x = max_x,
+		.max_y = max_y,
+		.w0 = edge_function_2(e0->nx, e0->ny, min_x + 0.5f, min_y + 0.5f, e0->c),
+		.w1 = edge_function_2(e1->nx, e1->ny, min_x + 0.5f, min_y + 0.5f, e1->c),
+		.w2 = edge_function_2(e2->nx, e2->ny, min_x + 0.5f, min_y + 0.5f, e2->c),
+		.fixed_w0 = clamp_fixed_edge_value(fixed_edge_function_at_pixel(e0, min_x, min_y)),
+		.fixed_w1 = clamp_fixed_edge_value(fixed_edge_function_at_pixel(e1, min_x, min_y)),
+		.fixed_w2 = clamp_fixed_edge_value(fixed_edge_function_at_pixel(e2, min_x, min_y)),
+		.depth =
+			  triangle->vertices[0].position.z
+			+ triangle->depth_dx * (min_x + 0.5f - triangle->vertices[0].position.x)
+			+ triangle->depth_dy * (min_y + 0.5f - triangle->vertices[0].position.y),
 	};
-	Vertex clip_buffer_b[10];
-	Vertex *input = clip_buffer_a;
-	Vertex *output = clip_buffer_b;
-	size_t input_count, output_count;
-	#define SWAP_POINTERS(Type, a, b) {\
-		Type *tmp = (a);\
-		(a) = (b);\
-		(b) = tmp;\
-	}
+	return result;
+}
 
-	// clip against the six frustum planes
-	// NOTE(mal): See "Essential Math" 7.4.3 and 7.4.4 about clipping
-
-	// clip +x
-	input_count  = 4;
-	output_count = clip_sutherland_hodgeman(0, -1, input, input_count, output);
-	// clip -x
-	SWAP_POINTERS(Vertex, input, output);
-	input_count  = output_count;
-	output_count = clip_sutherland_hodgeman(0, +1, input, input_count, output);
-	// clip +y
-	SWAP_POINTERS(Vertex, input, output);
-	input_count  = output_count;
-	output_count = clip_sutherland_hodgeman(1, -1, input, input_count, output);
-	// clip -y
-	SWAP_POINTERS(Vertex, input, output);
-	input_count  = output_count;
-	output_count = clip_sutherland_hodgeman(1, +1, input, input_count, output);
-	// clip +z
-	SWAP_POINTERS(Vertex, input, output);
-	input_count  = output_count;
-	output_count = clip_sutherland_hodgeman(2, -1, input, input_count, output);
-	// clip -z
-	SWAP_POINTERS(Vertex, input, output);
-	input_count  = output_count;
-	output_count = clip_sutherland_hodgeman(2, +1, input, input_count, output);
-
-	Vertex *clipped_vertices     = output;
-	size_t  clipped_vertex_count = output_count;
+bool is_depth_nearer(bool reverse_z, float a, float b) {
+	bool result = reverse_z ? a > b : a < b;
+	return result;
+}
 
-	//////////////////////////////
-	// END CLIPPING
-	//////////////////////////////
+// Hierarchical Z. Returns false if the triangle is entirely behind everything already stored in the
+// tile, in which case none of its pixels can pass the depth test. Otherwise updates the tile's depth
+// range to account for what the triangle is about to write.
+bool hierarchical_depth_test(RenderFrame *frame, RasterTriangle *triangle, RasterTile *tile, TileCoverage tile_coverage) {
+	TileDepthRange *range = &frame->tile_depth_ranges[
+		tile->min_x / RASTER_TILE_WIDTH + (tile->min_y / RASTER_TILE_HEIGHT) * frame->tile_count_x
+	];
+
+	// Depth is affine, so over the tile its extremes are at the corner pixels. Past the edges of the
+	// triangle that extrapolates beyond anything the triangle can actually produce, so also clamp
+	// to the range of its vertices' depths.
+	float extent_x = triangle->depth_dx * (tile->max_x - tile->min_x - 1);
+	float extent_y = triangle->depth_dy * (tile->max_y - tile->min_y - 1);
+	float min_depth = tile->depth + fminf(extent_x, 0.0f) + fminf(extent_y, 0.0f);
+	float max_depth = tile->depth + fmaxf(extent_x, 0.0f) + fmaxf(extent_y, 0.0f);
+	min_depth = fmaxf(min_depth, triangle->min_depth);
+	max_depth = fminf(max_depth, triangle->max_depth);
+	float nearest  = frame->reverse_z ? max_depth : min_depth;
+	float farthest = frame->reverse_z ? min_depth : max_depth;
+
+	if (!is_depth_nearer(frame->reverse_z, nearest, range->farthest)) {
+		return false;
+	}
 
-	// Take all clipped vertices from homogeneous clip space --> NDC --> screen
-	// Retain depth values for each vertex.
-	// TODO(mal): Should we just store the depth on the vertex itself?
-	float outer_reciprocal_depth[clipped_vertex_count];
-	for (int i = 0; i < clipped_vertex_count; i++) {
-		// NOTE(mal): After perspective projection and before perspective divide, the w
-		// component IS our view-space Z (depth) coordinate!
-		float reciprocal_w = 1.0f / clipped_vertices[i].position.w;
-		outer_reciprocal_depth[i] = reciprocal_w;
-		// perspective divide: homogeneous clip --> NDC
-		clipped_vertices[i].position.x *= reciprocal_w;
-		clipped_vertices[i].position.y *= reciprocal_w;
-		clipped_vertices[i].position.z *= reciprocal_w;
-		clipped_vertices[i].position.w *= reciprocal_w;
-		// NDC --> screen
-		clipped_vertices[i].position = mult_mat4x4_vec4(ndc_to_screen, clipped_vertices[i].position);
+	if (is_depth_nearer(frame->reverse_z, nearest, range->nearest)) {
+		range->nearest = nearest;
+	}
+	// Every pixel in the tile ends up with either what it had or the triangle's depth, whichever is
+	// nearer, so the farthest depth in the tile can't be any farther than the triangle's farthest.
+	if (tile_coverage == TILE_COVERAGE_FULL && is_depth_nearer(frame->reverse_z, farthest, range->farthest)) {
+		range->farthest = farthest;
 	}
+	return true;
+}
 
-	size_t triangle_fan_center_index = 0;
-	for (int i = 2; i < clipped_vertex_count; i++) {
-		// Grab our triangle from the fan generated by clipping. Also fix the winding order that
-		// we're about to screw up by transforming from homogenous clip --> NDC --> screen.
-		// TODO(mal): Stop copying, but then also need to make sure that we don't update the
-		// same vertices over and over again with perspective divides!
-		// OR maybe just change the edge function to assume CCW order instead of CW? Then we
-		// don't have to change the order of our vertices here.
-		Vertex triangle[3] = { clipped_vertices[i], clipped_vertices[i - 1], clipped_vertices[triangle_fan_center_index] };
-		float reciprocal_depth[3] = { outer_reciprocal_depth[i], outer_reciprocal_depth[i - 1], outer_reciprocal_depth[triangle_fan_center_index] };
-
-		// Compute the AABB of the triangle so that we don't have to loop over the entire buffer
-		// every time regardless of the size of the triangle.
-		// TODO(mal): Maybe create to_vec3_max(Vec3 a, Vec3 b) and to_vec3_min(Vec3 a, Vec3 b)
-		// functions and call those here instead?
-		int triangle_xmax =
-			triangle[0].position.x > triangle[1].position.x
-			? (triangle[0].position.x > triangle[2].position.x ? triangle[0].position.x : triangle[2].position.x)
-			: (triangle[1].position.x > triangle[2].position.x ? triangle[1].position.x : triangle[2].position.x);
-		int triangle_xmin =
-			triangle[0].position.x < triangle[1].position.x
-			? (triangle[0].position.x < triangle[2].position.x ? triangle[0].position.x : triangle[2].position.x)
-			: (triangle[1].position.x < triangle[2].position.x ? triangle[1].position.x : triangle[2].position.x);
-		int triangle_ymax =
-			triangle[0].position.y > triangle[1].position.y
-			? (triangle[0].position.y > triangle[2].position.y ? triangle[0].position.y : triangle[2].position.y)
-			: (triangle[1].position.y > triangle[2].position.y ? triangle[1].position.y : triangle[2].position.y);
-		int triangle_ymin =
-			triangle[0].position.y < triangle[1].position.y
-			? (triangle[0].position.y < triangle[2].position.y ? triangle[0].position.y : triangle[2].position.y)
-			: (triangle[1].position.y < triangle[2].position.y ? triangle[1].position.y : triangle[2].position.y);
-
-		// if (triangle_xmin < 0) triangle_xmin = 0;
-		// if (triangle_xmax > offscreen_buffer->width) triangle_xmax = offscreen_buffer->width;
-		// if (triangle_ymin < 0) triangle_ymin = 0;
-		// if (triangle_ymax > offscreen_buffer->height) triangle_ymax = offscreen_buffer->height;
-
-		ASSERT(triangle_xmin >= 0);
-		ASSERT(triangle_xmax <= offscreen_buffer->width);
-		ASSERT(triangle_ymin >= 0);
-		ASSERT(triangle_ymax <= offscreen_buffer->height);
-
-		// NOTE(mal): Does NOT account for winding order so at the moment we always render even if
-		// the triange is facing away from us.
-		if (game_state->render_wireframe) {
-			draw_line_2d(
-				pixels, offscreen_buffer->width, offscreen_buffer->height,
-				triangle[0].position.x, triangle[0].position.y, triangle[1].position.x, triangle[1].position.y
-			);
-			draw_line_2d(
-				pixels, offscreen_buffer->width, offscreen_buffer->height,
-				triangle[1].position.x, triangle[1].position.y, triangle[2].position.x, triangle[2].position.y
-			);
-			draw_line_2d(
-				pixels, offscreen_buffer->width, offscreen_buffer->height,
-				triangle[2].position.x, triangle[2].position.y, triangle[0].position.x, triangle[0].position.y
-			);
+//////////////////////////////
+// RASTERIZATION (HIERARCHICAL TILES)
+//////////////////////////////
+// See https://www.cs.cmu.edu/afs/cs/academic/class/15869-f11/www/readings/abrash09_lrbrast.pdf
+//     ^^^ Michael Abrash on the Larabee rasterizer.
+// It also has a great (implicit) explanation of what our barycentric weight deltas
+// actually are. (If I understand right, those values are just the amounts that the
+// edge function changes when stepping by some amount in the given direction (i.e.
+// +row, +col)).
+// We descend rect (bin, 64x64) -> raster tiles (16x16) -> blocks (4x4), doing the trivial
+// reject/accept corner tests at each level. Anything trivially accepted goes straight to a full
+// tile kernel at whatever size it was accepted, so the interior of a big triangle costs a handful
+// of corner tests, and only the blocks that actually straddle an edge pay for per-pixel coverage.
+// Raster tiles additionally get rejected if the triangle is hidden behind what's already been
+// drawn there (see hierarchical_depth_test). Triangles no bigger than a raster tile skip all of
+// this and go straight to a partial tile kernel.
+
+// Rasterize the part of the triangle that lies within [rect_min, rect_max).
+// NOTE(mal): rect_min MUST be aligned to the raster tile dimensions.
+void rasterize_triangle_in_rect(
+	RenderFrame *frame, RasterTriangle *triangle,
+	int rect_min_x, int rect_min_y, int rect_max_x, int rect_max_y
+)
+{
+	RasterTileFunction *tile_functions = raster_tile_functions[frame->raster_kernel];
+	if (frame->overdraw_counts) {
+		tile_functions = overdraw_tile_functions;
+	} else if (frame->visibility_buffer) {
+		tile_functions = visibility_tile_functions;
+	}
+	RasterTileFunction rasterize_partial_tile = tile_functions[0];
+	RasterTileFunction rasterize_full_tile    = tile_functions[1];
+
+	int xmin = triangle->xmin > rect_min_x ? triangle->xmin : rect_min_x;
+	int ymin = triangle->ymin > rect_min_y ? triangle->ymin : rect_min_y;
+	int xmax = triangle->xmax < rect_max_x - 1 ? triangle->xmax : rect_max_x - 1;
+	int ymax = triangle->ymax < rect_max_y - 1 ? triangle->ymax : rect_max_y - 1;
+
+	// Small triangles skip the hierarchy entirely: their whole AABB goes to a partial tile kernel
+	// as a single tile. Nothing that small has any interior tiles or blocks to trivially accept,
+	// so the corner tests would mostly be spent finding out which parts of the AABB to test per
+	// pixel anyway.
+	// NOTE(mal): With hierarchical Z on the AABB also has to lie within a single raster tile, since
+	// that's the granularity that depth ranges are kept at.
+	int aabb_width  = xmax - xmin + 1;
+	int aabb_height = ymax - ymin + 1;
+	bool is_small_triangle = aabb_width <= SMALL_TRIANGLE_MAX_WIDTH && aabb_height <= SMALL_TRIANGLE_MAX_HEIGHT;
+	if (is_small_triangle && frame->tile_depth_ranges) {
+		is_small_triangle =
+			(xmin & ~(RASTER_TILE_WIDTH  - 1)) == (xmax & ~(RASTER_TILE_WIDTH  - 1)) &&
+			(ymin & ~(RASTER_TILE_HEIGHT - 1)) == (ymax & ~(RASTER_TILE_HEIGHT - 1));
+	}
+	if (is_small_triangle) {
+		if (aabb_width <= 0 || aabb_height <= 0) {
+			return;
 		}
-
-		if (game_state->skip_rasterization) {
-			continue;
+		RasterTile tile = make_raster_tile(triangle, xmin, ymin, xmax + 1, ymax + 1);
+		if (frame->tile_depth_ranges && !hierarchical_depth_test(frame, triangle, &tile, TILE_COVERAGE_PARTIAL)) {
+			return;
 		}
+		rasterize_partial_tile(frame, triangle, &tile);
+		return;
+	}
 
-		//////////////////////////////
-		// TRIANGLE SETUP
-		//////////////////////////////
-
-		// Compute the topleft points of the tiles at the extremities
-		// (the topleft-most tile and the bottomright-most tile) of our
-		// triangle's AABB.
-		int bottomleft_tile_bottomleft_x = triangle_xmin - (triangle_xmin & (RASTER_TILE_WIDTH  - 1));
-		int bottomleft_tile_bottomleft_y = triangle_ymin - (triangle_ymin & (RASTER_TILE_HEIGHT - 1));
-		int topright_tile_bottomleft_x   = triangle_xmax - (triangle_xmax & (RASTER_TILE_WIDTH  - 1));
-		int topright_tile_bottomleft_y   = triangle_ymax - (triangle_ymax & (RASTER_TILE_HEIGHT - 1));
-
-		// TODO(mal): Set up for tiled rasterization
-		// https://fileadmin.cs.lth.se/graphics/research/papers/2005/cr/conservative.pdf
-		// Also see "Realtime Rendering" p996
-
-		// Setting up per-edge values
-		// NOTE(mal): The barycentric weight for a given vertex in the triangle is related to
-		// the area of the subtriangle defined by the test point p and the edge OPPOSITE the
-		// given vertex.
-		//
-		// NOTE(mal): Avoiding per-pixel edge function computation. This should be possible because the
-		// edge function is linear. Thus,
-		// E(x + 1, y) = E(x, y) + dY
-		// E(x, y + 1) = E(x, y) - dX
-		// https://www.cs.drexel.edu/~deb39/Classes/Papers/comp175-06-pineda.pdf
-		// Taking the algorithm for stepping from here: https://www.youtube.com/watch?v=k5wtuKWmV48
-		// at chapter "Avoiding Computing the Edge Function Per-Pixel".
-
-		// edge v0 to v1
-		float v0v1_nx =  (triangle[1].position.y - triangle[0].position.y);
-		float v0v1_ny = -(triangle[1].position.x - triangle[0].position.x);
-		float v0v1_c =
-			// -N dot edge_start_vertex
-			  (-v0v1_nx * triangle[0].position.x)
-			+ (-v0v1_ny * triangle[0].position.y)
-			+ bottom_right_bias(v0v1_nx, v0v1_ny);
-		float d_w2_col = v0v1_nx;
-		float d_w2_row = v0v1_ny;
-		Vec2 tile_offset_most_inside_v0v1 = {
-			.x = v0v1_nx < 0.0f ? 0.0f : RASTER_TILE_WIDTH,
-			.y = v0v1_ny < 0.0f ? 0.0f : RASTER_TILE_HEIGHT
-		};
-		Vec2 tile_offset_most_outside_v0v1 = {
-			.x = v0v1_nx < 0.0f ? RASTER_TILE_WIDTH : 0.0f,
-			.y = v0v1_ny < 0.0f ? RASTER_TILE_HEIGHT : 0.0f,
-		};
-
-		// edge v1 to v2
-		float v1v2_nx =  (triangle[2].position.y - triangle[1].position.y);
-		float v1v2_ny = -(triangle[2].position.x - triangle[1].position.x);
-		float v1v2_c =
-			  (-v1v2_nx * triangle[1].position.x)
-			+ (-v1v2_ny * triangle[1].position.y)
-			+ bottom_right_bias(v1v2_nx, v1v2_ny);
-		float d_w0_col = v1v2_nx;
-		float d_w0_row = v1v2_ny;
-		Vec2 tile_offset_most_inside_v1v2 = {
-			.x = v1v2_nx < 0.0f ? 0.0f : RASTER_TILE_WIDTH,
-			.y = v1v2_ny < 0.0f ? 0.0f : RASTER_TILE_HEIGHT
-		};
-		Vec2 tile_offset_most_outside_v1v2 = {
-			.x = v1v2_nx < 0.0f ? RASTER_TILE_WIDTH : 0.0f,
-			.y = v1v2_ny < 0.0f ? RASTER_TILE_HEIGHT : 0.0f,
-		};
-
-		// edge v2 to v0
-		float v2v0_nx =  (triangle[0].position.y - triangle[2].position.y);
-		float v2v0_ny = -(triangle[0].position.x - triangle[2].position.x);
-		float v2v0_c =
-			  (-v2v0_nx * triangle[2].position.x)
-			+ (-v2v0_ny * triangle[2].position.y)
-			+ bottom_right_bias(v2v0_nx, v2v0_ny);
-		float d_w1_col = v2v0_nx;
-		float d_w1_row = v2v0_ny;
-		Vec2 tile_offset_most_inside_v2v0 = {
-			.x = v2v0_nx < 0.0f ? 0.0f : RASTER_TILE_WIDTH,
-			.y = v2v0_ny < 0.0f ? 0.0f : RASTER_TILE_HEIGHT
-		};
-		Vec2 tile_offset_most_outside_v2v0 = {
-			.x = v2v0_nx < 0.0f ? RASTER_TILE_WIDTH : 0.0f,
-			.y = v2v0_ny < 0.0f ? RASTER_TILE_HEIGHT : 0.0f,
-		};
-
-		//////////////////////////////
-		// RASTERIZATION (TILED)
-		//////////////////////////////
-		// TODO(mal): For future optimization, might be able to add another layer of tiling and
-		// then apply vectorization.
-		// See https://www.cs.cmu.edu/afs/cs/academic/class/15869-f11/www/readings/abrash09_lrbrast.pdf
-		//     ^^^ Michael Abrash on the Larabee rasterizer.
-		// It also has a great (implicit) explanation of what our barycentric weight deltas
-		// actually are. (If I understand right, those values are just the amounts that the
-		// edge function changes when stepping by some amount in the given direction (i.e.
-		// +row, +col)).
+	// LEVEL 0: the whole rect
+	TileCoverage rect_coverage = classify_tile(
+		triangle, rect_min_x, rect_min_y, rect_max_x - rect_min_x, rect_max_y - rect_min_y
+	);
+	if (rect_coverage == TILE_COVERAGE_NONE) {
+		return;
+	}
+	// NOTE(mal): With hierarchical Z on, a fully covered rect still goes through the tile loop below
+	// so that every tile gets depth tested and has its depth range updated.
+	if (rect_coverage == TILE_COVERAGE_FULL && !frame->tile_depth_ranges) {
+		RasterTile tile = make_raster_tile(triangle, rect_min_x, rect_min_y, rect_max_x, rect_max_y);
+		rasterize_full_tile(frame, triangle, &tile);
+		return;
+	}
 
+	// Compute the topleft points of the tiles at the extremities
+	// (the topleft-most tile and the bottomright-most tile) of our
+	// triangle's AABB.
+	int bottomleft_tile_bottomleft_x = xmin - (xmin & (RASTER_TILE_WIDTH  - 1));
+	int bottomleft_tile_bottomleft_y = ymin - (ymin & (RASTER_TILE_HEIGHT - 1));
+	int topright_tile_bottomleft_x   = xmax - (xmax & (RASTER_TILE_WIDTH  - 1));
+	int topright_tile_bottomleft_y   = ymax - (ymax & (RASTER_TILE_HEIGHT - 1));
+
+	for (
+		int tile_min_y = bottomleft_tile_bottomleft_y;
+		tile_min_y <= topright_tile_bottomleft_y;
+		tile_min_y += RASTER_TILE_HEIGHT
+	)
+	{
 		for (
-			int tile_min_y = bottomleft_tile_bottomleft_y;
-			tile_min_y <= topright_tile_bottomleft_y;
-			tile_min_y += RASTER_TILE_HEIGHT
+			int tile_min_x = bottomleft_tile_bottomleft_x;
+			tile_min_x <= topright_tile_bottomleft_x;
+			tile_min_x += RASTER_TILE_WIDTH
 		)
 		{
-			for (
-				int tile_min_x = bottomleft_tile_bottomleft_x;
-				tile_min_x <= topright_tile_bottomleft_x;
-				tile_min_x += RASTER_TILE_WIDTH
-			)
-			{
-
-				bool is_tile_fully_outside_v0v1 = edge_function_2(
-					v0v1_nx, v0v1_ny,
-					tile_min_x + tile_offset_most_inside_v0v1.x,
-					tile_min_y + tile_offset_most_inside_v0v1.y,
-					v0v1_c
-				) < 0.0f;
-				bool is_tile_fully_outside_v1v2 = edge_function_2(
-					v1v2_nx, v1v2_ny,
-					tile_min_x + tile_offset_most_inside_v1v2.x,
-					tile_min_y + tile_offset_most_inside_v1v2.y,
-					v1v2_c
-				) < 0.0f;
-				bool is_tile_fully_outside_v2v0 = edge_function_2(
-					v2v0_nx, v2v0_ny,
-					tile_min_x + tile_offset_most_inside_v2v0.x,
-					tile_min_y + tile_offset_most_inside_v2v0.y,
-					v2v0_c
-				) < 0.0f;
-				bool is_tile_fully_outside_triangle =
-					   is_tile_fully_outside_v0v1
-					|| is_tile_fully_outside_v1v2
-					|| is_tile_fully_outside_v2v0;
-				if (is_tile_fully_outside_triangle) {
-					continue;
-				}
-
-				// A tile is fully inside an edge if its most outside vertex is inside the edge.
-				bool is_tile_fully_inside_v0v1 = edge_function_2(
-					v0v1_nx, v0v1_ny,
-					tile_min_x + tile_offset_most_outside_v0v1.x,
-					tile_min_y + tile_offset_most_outside_v0v1.y,
-					v0v1_c
-				) >= 0.0f;
-				bool is_tile_fully_inside_v1v2 = edge_function_2(
-					v1v2_nx, v1v2_ny,
-					tile_min_x + tile_offset_most_outside_v1v2.x,
-					tile_min_y + tile_offset_most_outside_v1v2.y,
-					v1v2_c
-				) >= 0.0f;
-				bool is_tile_fully_inside_v2v0 = edge_function_2(
-					v2v0_nx, v2v0_ny,
-					tile_min_x + tile_offset_most_outside_v2v0.x,
-					tile_min_y + tile_offset_most_outside_v2v0.y,
-					v2v0_c
-				) >= 0.0f;
-				bool is_tile_fully_inside_triangle =
-					   is_tile_fully_inside_v0v1
-					&& is_tile_fully_inside_v1v2
-					&& is_tile_fully_inside_v2v0;
-
-				float w0_row = edge_function_2(
-					v1v2_nx, v1v2_ny,
-					tile_min_x + 0.5f, tile_min_y + 0.5f,
-					v1v2_c
-				);
-				float w1_row = edge_function_2(
-					v2v0_nx, v2v0_ny,
-					tile_min_x + 0.5f, tile_min_y + 0.5f,
-					v2v0_c
-				);
-				float w2_row = edge_function_2(
-					v0v1_nx, v0v1_ny,
-					tile_min_x + 0.5f, tile_min_y + 0.5f,
-					v0v1_c
-				);
-
-				int tile_max_x = tile_min_x + RASTER_TILE_WIDTH;
-				if (tile_max_x >= offscreen_buffer->width) tile_max_x = offscreen_buffer->width;
-				int tile_max_y = tile_min_y + RASTER_TILE_HEIGHT;
-				if (tile_max_y >= offscreen_buffer->height) tile_max_y = offscreen_buffer->height;
-
-				// Loop over the pixels in the tile
-				for (int row = tile_min_y; row < tile_max_y; row++) {
-					float w0 = w0_row;
-					float w1 = w1_row;
-					float w2 = w2_row;
-					for (int col = tile_min_x; col < tile_max_x; col++) {
-						// TODO(mal): two separate loops:
-						// - if tile fully inside triangle, no weight check
-						// - if partially inside, weight check
-						if (is_tile_fully_inside_triangle || (w0 >= 0.0f && w1 >= 0.0f && w2 >= 0.0f)) {
-							// TODO(mal): Rename some of this stuff. Names are taken from Realtime
-							// Rendering. See p1000 for perspective-correct barycentric interpolation.
-							// I believe here we're essentially foreshortening our barycentric coordinates.
-							float f0 = w0 * reciprocal_depth[0];
-							float f1 = w1 * reciprocal_depth[1];
-							float f2 = w2 * reciprocal_depth[2];
-							float perspective_reciprocal_area = 1.0f / (f0 + f1 + f2);
-
-							// TEXTURING
-							float tx_u = (f0 * triangle[0].tx_u + f1 * triangle[1].tx_u + f2 * triangle[2].tx_u) * perspective_reciprocal_area;
-							float tx_v = (f0 * triangle[0].tx_v + f1 * triangle[1].tx_v + f2 * triangle[2].tx_v) * perspective_reciprocal_area;
-							unsigned tx_x = (unsigned)(tx_u * game_state->texture_width);
-							unsigned tx_y = (unsigned)(tx_v * game_state->texture_height);
-							unsigned texel_index = tx_x + tx_y * game_state->texture_width;
-							// FIXME(mal): Need to detect machine's endianness and extract the bits
-							// properly. Check the 32-bit color format of TGA (or any other texture
-							// file we may load). I believe it's BGRA.
-							uint32_t texel_tga_color = game_state->texture_pixels[texel_index];
-							uint8_t  texel_red       = (texel_tga_color & 0x00FF0000) >> 16;
-							uint8_t  texel_green     = (texel_tga_color & 0x0000FF00) >> 8;
-							uint8_t  texel_blue      = texel_tga_color & 0x000000FF;
-							uint32_t texel_color     = (texel_red << 16) | (texel_green << 8) | texel_blue;
-							pixels[col + row * offscreen_buffer->width] = texel_color;
-
-							// #define U32_R8(x) (((x) & (0xFF << 16)) >> 16)
-							// #define U32_G8(x) (((x) & (0xFF << 8)) >> 8)
-							// #define U32_B8(x) ((x) & 0xFF)
-							// uint8_t color_red   = (f0 * U32_R8(vs[0].color) + f1 * U32_R8(vs[1].color) + f2 * U32_R8(vs[2].color)) * perspective_reciprocal_area;
-							// uint8_t color_green = (f0 * U32_G8(vs[0].color) + f1 * U32_G8(vs[1].color) + f2 * U32_G8(vs[2].color)) * perspective_reciprocal_area;
-							// uint8_t color_blue  = (f0 * U32_B8(vs[0].color) + f1 * U32_B8(vs[1].color) + f2 * U32_B8(vs[2].color)) * perspective_reciprocal_area;
-							// pixels[col + row * offscreen_buffer->width] =
-							// 	color_red << 16
-							// 	| color_green << 8
-							// 	| color_blue;
+			int tile_max_x = tile_min_x + RASTER_TILE_WIDTH  < rect_max_x ? tile_min_x + RASTER_TILE_WIDTH  : rect_max_x;
+			int tile_max_y = tile_min_y + RASTER_TILE_HEIGHT < rect_max_y ? tile_min_y + RASTER_TILE_HEIGHT : rect_max_y;
+
+			// LEVEL 1: raster tiles
+			TileCoverage tile_coverage = rect_coverage == TILE_COVERAGE_FULL
+				? TILE_COVERAGE_FULL
+				: classify_tile(triangle, tile_min_x, tile_min_y, RASTER_TILE_WIDTH, RASTER_TILE_HEIGHT);
+			if (tile_coverage == TILE_COVERAGE_NONE) {
+				continue;
+			}
+			RasterTile tile = make_raster_tile(triangle, tile_min_x, tile_min_y, tile_max_x, tile_max_y);
+			if (frame->tile_depth_ranges && !hierarchical_depth_test(frame, triangle, &tile, tile_coverage)) {
+				continue;
+			}
+			if (tile_coverage == TILE_COVERAGE_FULL) {
+				rasterize_full_tile(frame, triangle, &tile);
+				continue;
+			}
 
+			// LEVEL 2: blocks
+			// NOTE(mal): Horizontally adjacent blocks with the same coverage are merged into one run
+			// before calling a kernel, otherwise the 8-wide AVX2 kernel would waste half its lanes
+			// on every block.
+			for (int block_min_y = tile_min_y; block_min_y < tile_max_y; block_min_y += RASTER_BLOCK_HEIGHT) {
+				int block_max_y = block_min_y + RASTER_BLOCK_HEIGHT < tile_max_y ? block_min_y + RASTER_BLOCK_HEIGHT : tile_max_y;
+				int run_min_x = tile_min_x;
+				TileCoverage run_coverage = TILE_COVERAGE_NONE;
+				for (int block_min_x = tile_min_x; ; block_min_x += RASTER_BLOCK_WIDTH) {
+					bool is_past_tile = block_min_x >= tile_max_x;
+					// Treating the end of the tile as an uncovered block flushes the last run.
+					TileCoverage block_coverage = is_past_tile
+						? TILE_COVERAGE_NONE
+						: classify_tile(triangle, block_min_x, block_min_y, RASTER_BLOCK_WIDTH, RASTER_BLOCK_HEIGHT);
+					if (block_coverage != run_coverage) {
+						if (run_coverage != TILE_COVERAGE_NONE) {
+							int run_max_x = block_min_x < tile_max_x ? block_min_x : tile_max_x;
+							RasterTile run = make_raster_tile(triangle, run_min_x, block_min_y, run_max_x, block_max_y);
+							if (run_coverage == TILE_COVERAGE_FULL) {
+								rasterize_full_tile(frame, triangle, &run);
+							} else {
+								rasterize_partial_tile(frame, triangle, &run);
+							}
 						}
-
-						w0 += d_w0_col;
-						w1 += d_w1_col;
-						w2 += d_w2_col;
+						run_min_x = block_min_x;
+						run_coverage = block_coverage;
+					}
+					if (is_past_tile) {
+						break;
 					}
-
-					w0_row += d_w0_row;
-					w1_row += d_w1_row;
-					w2_row += d_w2_row;
 				}
 			}
 		}
 	}
+}
 
-	if (game_state->render_raster_tile_state == RENDER_RASTER_TILES_ONTOP) {
-		// NOTE(mal): MUST be powers of 2!
-		for (int r = 0; r < offscreen_buffer->height; r++) {
-			const int row_offset = r * offscreen_buffer->width;
-			for (int c = 0; c < offscreen_buffer->width; c++) {
-				uint32_t *pixel = &pixels[c + row_offset];
-				if (!(c & (RASTER_TILE_WIDTH - 1)) || !(r & (RASTER_TILE_HEIGHT - 1))) {
-					*pixel = RASTER_TILE_COLOR;
+// The depth that everything passes the depth test against.
+float depth_clear_value(bool reverse_z) {
+	float result = reverse_z ? 0.0f : 1.0f;
+	return result;
+}
+
+// NOTE(mal): The rect must be aligned to raster tiles (or the edge of the frame) so that the tile
+// depth ranges get reset along with it.
+void clear_depth_rect(RenderFrame *frame, int min_x, int min_y, int max_x, int max_y) {
+	ASSERT(min_x % RASTER_TILE_WIDTH == 0 && min_y % RASTER_TILE_HEIGHT == 0);
+	float clear_value = depth_clear_value(frame->reverse_z);
+	for (int row = min_y; row < max_y; row++) {
+		float *row_depths = frame->depth_buffer + row * frame->width;
+		for (int col = min_x; col < max_x; col++) {
+			row_depths[col] = clear_value;
+		}
+	}
+
+	if (frame->tile_depth_ranges) {
+		for (int tile_y = min_y / RASTER_TILE_HEIGHT; tile_y * RASTER_TILE_HEIGHT < max_y; tile_y++) {
+			for (int tile_x = min_x / RASTER_TILE_WIDTH; tile_x * RASTER_TILE_WIDTH < max_x; tile_x++) {
+				frame->tile_depth_ranges[tile_x + tile_y * frame->tile_count_x] = (TileDepthRange){
+					.nearest  = clear_value,
+					.farthest = clear_value,
+				};
+			}
+		}
+	}
+}
+
+// Fills [min, max) of the frame's pixels with color.
+void clear_pixel_rect(RenderFrame *frame, int min_x, int min_y, int max_x, int max_y, uint32_t color) {
+#ifdef RASTER_SIMD_X64
+	__m128i colors = _mm_set1_epi32((int32_t)color);
+#endif
+	for (int row = min_y; row < max_y; row++) {
+		uint32_t *row_pixels = frame->pixels + row * frame->width;
+		int col = min_x;
+#ifdef RASTER_SIMD_X64
+		// 4 pixels per store
+		for (; col + 4 <= max_x; col += 4) {
+			_mm_storeu_si128((__m128i *)(row_pixels + col), colors);
+		}
+#endif
+		for (; col < max_x; col++) {
+			row_pixels[col] = color;
+		}
+	}
+}
+
+// Draws the lines along the top and left edges of every raster tile within [min, max).
+void draw_raster_tile_grid(RenderFrame *frame, int min_x, int min_y, int max_x, int max_y) {
+	int first_line_x = (min_x + RASTER_TILE_WIDTH  - 1) & ~(RASTER_TILE_WIDTH  - 1);
+	int first_line_y = (min_y + RASTER_TILE_HEIGHT - 1) & ~(RASTER_TILE_HEIGHT - 1);
+	for (int row = first_line_y; row < max_y; row += RASTER_TILE_HEIGHT) {
+		clear_pixel_rect(frame, min_x, row, max_x, row + 1, RASTER_TILE_COLOR);
+	}
+	for (int row = min_y; row < max_y; row++) {
+		uint32_t *row_pixels = frame->pixels + row * frame->width;
+		for (int col = first_line_x; col < max_x; col += RASTER_TILE_WIDTH) {
+			row_pixels[col] = RASTER_TILE_COLOR;
+		}
+	}
+}
+
+void clear_visibility_rect(RenderFrame *frame, int min_x, int min_y, int max_x, int max_y) {
+	for (int row = min_y; row < max_y; row++) {
+		VisibilitySample *row_samples = frame->visibility_buffer + row * frame->width;
+		for (int col = min_x; col < max_x; col++) {
+			row_samples[col].triangle_index = VISIBILITY_SAMPLE_EMPTY;
+		}
+	}
+}
+
+// Visibility buffer resolve: textures every covered pixel in the rect from the triangle and
+// barycentrics that ended up in it.
+void resolve_visibility_rect(RenderFrame *frame, int min_x, int min_y, int max_x, int max_y) {
+	for (int row = min_y; row < max_y; row++) {
+		VisibilitySample *row_samples = frame->visibility_buffer + row * frame->width;
+		uint32_t *row_pixels = frame->pixels + row * frame->width;
+		for (int col = min_x; col < max_x; col++) {
+			VisibilitySample *sample = &row_samples[col];
+			if (sample->triangle_index == VISIBILITY_SAMPLE_EMPTY) {
+				continue;
+			}
+			Vertex *vs = frame->triangles[sample->triangle_index].vertices;
+			float b1 = sample->b1 * (1.0f / 65535.0f);
+			float b2 = sample->b2 * (1.0f / 65535.0f);
+			float b0 = 1.0f - b1 - b2;
+
+			// TEXTURING
+			float tx_u = b0 * vs[0].tx_u + b1 * vs[1].tx_u + b2 * vs[2].tx_u;
+			float tx_v = b0 * vs[0].tx_v + b1 * vs[1].tx_v + b2 * vs[2].tx_v;
+			row_pixels[col] = sample_texture(frame, tx_u, tx_v);
+		}
+	}
+}
+
+// FNV-1a over the rect's pixels.
+// NOTE(mal): Four independent hashes over every 4th pixel, combined at the end, since a single one
+// is one long chain of dependent multiplies.
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ull
+#define FNV_PRIME        0x100000001b3ull
+uint64_t hash_pixel_rect(RenderFrame *frame, int min_x, int min_y, int max_x, int max_y) {
+	uint64_t lanes[4] = { FNV_OFFSET_BASIS, FNV_OFFSET_BASIS, FNV_OFFSET_BASIS, FNV_OFFSET_BASIS };
+	for (int row = min_y; row < max_y; row++) {
+		uint32_t *row_pixels = frame->pixels + row * frame->width;
+		int col = min_x;
+		for (; col + 4 <= max_x; col += 4) {
+			lanes[0] = (lanes[0] ^ row_pixels[col + 0]) * FNV_PRIME;
+			lanes[1] = (lanes[1] ^ row_pixels[col + 1]) * FNV_PRIME;
+			lanes[2] = (lanes[2] ^ row_pixels[col + 2]) * FNV_PRIME;
+			lanes[3] = (lanes[3] ^ row_pixels[col + 3]) * FNV_PRIME;
+		}
+		for (; col < max_x; col++) {
+			lanes[0] = (lanes[0] ^ row_pixels[col]) * FNV_PRIME;
+		}
+	}
+	uint64_t hash = FNV_OFFSET_BASIS;
+	for (int i = 0; i < 4; i++) {
+		hash = (hash ^ lanes[i]) * FNV_PRIME;
+	}
+	return hash;
+}
+
+// Work queue callback: clears a single bin and rasterizes every triangle binned to it, in
+// submission order.
+// In visibility buffer mode, it then resolves the bin. No other bin's triangles can touch its
+// pixels, so there's no need to wait for the rest of the frame to finish rasterizing first.
+void render_bin_work(PlatformWorkQueue *queue, void *data) {
+	// NOTE(mal): The only way the render workers get into the game, so this is where they get bound.
+	PROFILE_BIND_THREAD();
+	RenderBinJob *job = (RenderBinJob *)data;
+	RenderFrame *frame = job->frame;
+
+	int bin_index = job->bin_x + job->bin_y * frame->bin_count_x;
+	int bin_min_x = job->bin_x * RENDER_BIN_WIDTH;
+	int bin_min_y = job->bin_y * RENDER_BIN_HEIGHT;
+	int bin_max_x = bin_min_x + RENDER_BIN_WIDTH;
+	int bin_max_y = bin_min_y + RENDER_BIN_HEIGHT;
+	if (bin_max_x > frame->width)  bin_max_x = frame->width;
+	if (bin_max_y > frame->height) bin_max_y = frame->height;
+
+	PROFILE_BEGIN("clear");
+	clear_pixel_rect(frame, bin_min_x, bin_min_y, bin_max_x, bin_max_y, CLEAR_COLOR);
+	if (frame->raster_tile_grid == RENDER_RASTER_TILES_BELOW) {
+		draw_raster_tile_grid(frame, bin_min_x, bin_min_y, bin_max_x, bin_max_y);
+	}
+	if (!frame->skip_rasterization) {
+		if (frame->depth_clear_policy == DEPTH_CLEAR_PER_BIN) {
+			clear_depth_rect(frame, bin_min_x, bin_min_y, bin_max_x, bin_max_y);
+		}
+		if (frame->visibility_buffer) {
+			clear_visibility_rect(frame, bin_min_x, bin_min_y, bin_max_x, bin_max_y);
+		}
+	}
+	PROFILE_END("clear");
+
+	if (!frame->skip_rasterization) {
+		PROFILE_BEGIN("tile loop");
+		uint32_t first = frame->bin_triangle_offsets[bin_index];
+		uint32_t last  = frame->bin_triangle_offsets[bin_index + 1];
+		for (uint32_t i = first; i < last; i++) {
+			RasterTriangle *triangle = &frame->triangles[frame->bin_triangle_indices[i]];
+			rasterize_triangle_in_rect(frame, triangle, bin_min_x, bin_min_y, bin_max_x, bin_max_y);
+		}
+		PROFILE_END("tile loop");
+
+		if (frame->visibility_buffer) {
+			resolve_visibility_rect(frame, bin_min_x, bin_min_y, bin_max_x, bin_max_y);
+		}
+	}
+
+	// NOTE(mal): Hashing while the bin's pixels are still in cache. A bin whose pixels hash the same
+	// as last frame is (barring a collision) unchanged, so it doesn't need to be presented again.
+	uint64_t hash = hash_pixel_rect(frame, bin_min_x, bin_min_y, bin_max_x, bin_max_y);
+	frame->bin_damaged[bin_index] = hash != frame->bin_pixel_hashes[bin_index];
+	frame->bin_pixel_hashes[bin_index] = hash;
+}
+
+// Merges the damaged bins into as few rects as is easy: runs of damaged bins within a row of bins,
+// extended downwards for as long as the next row has a run covering exactly the same columns.
+void build_damage_rects(RenderFrame *frame, GameOffscreenBuffer *offscreen_buffer) {
+	GameRect *rects = offscreen_buffer->damage_rects;
+	int rect_count = 0;
+	for (int bin_y = 0; bin_y < frame->bin_count_y; bin_y++) {
+		int run_min_x = -1;
+		for (int bin_x = 0; bin_x <= frame->bin_count_x; bin_x++) {
+			bool is_damaged = bin_x < frame->bin_count_x && frame->bin_damaged[bin_x + bin_y * frame->bin_count_x];
+			if (is_damaged && run_min_x < 0) {
+				run_min_x = bin_x;
+			}
+			if (is_damaged || run_min_x < 0) {
+				continue;
+			}
+
+			int min_x = run_min_x * RENDER_BIN_WIDTH;
+			int min_y = bin_y * RENDER_BIN_HEIGHT;
+			int max_x = bin_x * RENDER_BIN_WIDTH;
+			int max_y = min_y + RENDER_BIN_HEIGHT;
+			if (max_x > frame->width)  max_x = frame->width;
+			if (max_y > frame->height) max_y = frame->height;
+			GameRect run = { .x = min_x, .y = min_y, .width = max_x - min_x, .height = max_y - min_y };
+			run_min_x = -1;
+
+			bool is_merged = false;
+			for (int r_i = 0; r_i < rect_count; r_i++) {
+				GameRect *rect = &rects[r_i];
+				if (rect->x == run.x && rect->width == run.width && rect->y + rect->height == run.y) {
+					rect->height += run.height;
+					is_merged = true;
+					break;
 				}
 			}
+			if (is_merged) {
+				continue;
+			}
+			if (rect_count == GAME_MAX_DAMAGE_RECTS) {
+				// Too scattered to be worth listing, just damage everything.
+				rects[0] = (GameRect){ .x = 0, .y = 0, .width = frame->width, .height = frame->height };
+				offscreen_buffer->damage_rect_count = 1;
+				return;
+			}
+			rects[rect_count++] = run;
+		}
+	}
+	offscreen_buffer->damage_rect_count = rect_count;
+}
+
+// Assign each triangle to every bin its AABB overlaps.
+// NOTE(mal): Two passes (count, then fill) so that the per-bin lists can be packed tightly into
+// one array without knowing up front how many triangles land in each bin.
+void bin_triangles(RenderFrame *frame, MemoryArena *arena) {
+	frame->bin_count_x = (frame->width  + RENDER_BIN_WIDTH  - 1) / RENDER_BIN_WIDTH;
+	frame->bin_count_y = (frame->height + RENDER_BIN_HEIGHT - 1) / RENDER_BIN_HEIGHT;
+	int bin_count = frame->bin_count_x * frame->bin_count_y;
+	frame->bin_triangle_offsets = push_array(arena, bin_count + 1, uint32_t);
+	memset(frame->bin_triangle_offsets, 0, (bin_count + 1) * sizeof(uint32_t));
+
+	#define TRIANGLE_BIN_RANGE(triangle)\
+		int bin_x_min = (triangle)->xmin / RENDER_BIN_WIDTH;\
+		int bin_y_min = (triangle)->ymin / RENDER_BIN_HEIGHT;\
+		int bin_x_max = (triangle)->xmax / RENDER_BIN_WIDTH;\
+		int bin_y_max = (triangle)->ymax / RENDER_BIN_HEIGHT;\
+		if (bin_x_max >= frame->bin_count_x) bin_x_max = frame->bin_count_x - 1;\
+		if (bin_y_max >= frame->bin_count_y) bin_y_max = frame->bin_count_y - 1;
+
+	// Count. We count into offsets[b + 1] so that the prefix sum below leaves offsets[b] at the
+	// start of bin b.
+	uint32_t total_bin_entries = 0;
+	for (uint32_t t_i = 0; t_i < frame->triangle_count; t_i++) {
+		TRIANGLE_BIN_RANGE(&frame->triangles[t_i]);
+		for (int bin_y = bin_y_min; bin_y <= bin_y_max; bin_y++) {
+			for (int bin_x = bin_x_min; bin_x <= bin_x_max; bin_x++) {
+				frame->bin_triangle_offsets[bin_x + bin_y * frame->bin_count_x + 1]++;
+				total_bin_entries++;
+			}
+		}
+	}
+
+	for (int b = 0; b < bin_count; b++) {
+		frame->bin_triangle_offsets[b + 1] += frame->bin_triangle_offsets[b];
+	}
+
+	// Fill. Triangles are visited in submission order so each bin's list stays in submission order.
+	frame->bin_triangle_indices = push_array(arena, total_bin_entries, uint32_t);
+	uint32_t *bin_write_cursors = push_array(arena, bin_count, uint32_t);
+	memcpy(bin_write_cursors, frame->bin_triangle_offsets, bin_count * sizeof(uint32_t));
+	for (uint32_t t_i = 0; t_i < frame->triangle_count; t_i++) {
+		TRIANGLE_BIN_RANGE(&frame->triangles[t_i]);
+		for (int bin_y = bin_y_min; bin_y <= bin_y_max; bin_y++) {
+			for (int bin_x = bin_x_min; bin_x <= bin_x_max; bin_x++) {
+				frame->bin_triangle_indices[bin_write_cursors[bin_x + bin_y * frame->bin_count_x]++] = t_i;
+			}
 		}
 	}
+	#undef TRIANGLE_BIN_RANGE
+}
 
+//////////////////////////////
+// WATERTIGHTNESS TEST
+//////////////////////////////
+// Instead of the scene, rasterize a dense mesh of randomly jittered triangles that exactly tiles
+// the screen, counting how many times each pixel is covered. With a correct fill rule every pixel
+// is covered exactly once: no gaps along shared edges, and no pixel drawn by two triangles.
+// NOTE(mal): Deliberately not multiples of the tile/bin sizes so that the mesh's edges land
+// everywhere relative to tiles, blocks and SIMD lanes.
+#define WATERTIGHT_TEST_CELLS_X 101
+#define WATERTIGHT_TEST_CELLS_Y 77
+#define WATERTIGHT_UNWRITTEN_COLOR 0x000000FF
+#define WATERTIGHT_WRITTEN_COLOR   0x00404040
+#define WATERTIGHT_OVERDRAWN_COLOR 0x00FF0000
+
+uint32_t xorshift32(uint32_t *state) {
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
 }
 
-EXPORT void game_update(GameMemory *memory, GameInput *input) {
-	GameState *game_state = (GameState *)memory->storage;
+// Replaces the frame's triangles with the test mesh.
+void setup_watertight_test_mesh(RenderFrame *frame, MemoryArena *arena, uint32_t seed) {
+	int vertex_count_x = WATERTIGHT_TEST_CELLS_X + 1;
+	int vertex_count_y = WATERTIGHT_TEST_CELLS_Y + 1;
+	Vertex *vertices = push_array(arena, vertex_count_x * vertex_count_y, Vertex);
+	float cell_width  = (float)frame->width  / WATERTIGHT_TEST_CELLS_X;
+	float cell_height = (float)frame->height / WATERTIGHT_TEST_CELLS_Y;
+	// Every other seed snaps the vertices to half pixels, which puts lots of pixel centers exactly
+	// on edges (and makes plenty of edges exactly horizontal or vertical) to exercise the tie
+	// breaking in the fill rule.
+	bool snap_to_half_pixels = seed & 1;
+	uint32_t rng = seed * 2654435761u + 1;
+	for (int j = 0; j < vertex_count_y; j++) {
+		for (int i = 0; i < vertex_count_x; i++) {
+			float x = i * cell_width;
+			float y = j * cell_height;
+			// Vertices move by at most a quarter of a cell so that no quad ever folds over on itself.
+			// Vertices on the border of the screen only move along the border.
+			if (i > 0 && i < vertex_count_x - 1) {
+				x += ((xorshift32(&rng) & 0xFFFF) / 65535.0f - 0.5f) * 0.5f * cell_width;
+			}
+			if (j > 0 && j < vertex_count_y - 1) {
+				y += ((xorshift32(&rng) & 0xFFFF) / 65535.0f - 0.5f) * 0.5f * cell_height;
+			}
+			if (snap_to_half_pixels) {
+				x = floorf(x * 2.0f + 0.5f) / 2.0f;
+				y = floorf(y * 2.0f + 0.5f) / 2.0f;
+			}
+			vertices[i + j * vertex_count_x] = (Vertex){ .position = { .x = x, .y = y, .w = 1.0f } };
+		}
+	}
+
+	frame->triangles = push_array(arena, 2 * WATERTIGHT_TEST_CELLS_X * WATERTIGHT_TEST_CELLS_Y, RasterTriangle);
+	frame->triangle_count = 0;
+	for (int j = 0; j < WATERTIGHT_TEST_CELLS_Y; j++) {
+		for (int i = 0; i < WATERTIGHT_TEST_CELLS_X; i++) {
+			Vertex *top_left     = &vertices[(i + 0) + (j + 0) * vertex_count_x];
+			Vertex *top_right    = &vertices[(i + 1) + (j + 0) * vertex_count_x];
+			Vertex *bottom_left  = &vertices[(i + 0) + (j + 1) * vertex_count_x];
+			Vertex *bottom_right = &vertices[(i + 1) + (j + 1) * vertex_count_x];
+			// Alternate the diagonal so that both orientations get tested.
+			if ((i + j) & 1) {
+				setup_raster_triangle(&frame->triangles[frame->triangle_count++], top_left, bottom_left, bottom_right, 1.0f, 1.0f, 1.0f);
+				setup_raster_triangle(&frame->triangles[frame->triangle_count++], top_left, bottom_right, top_right, 1.0f, 1.0f, 1.0f);
+			} else {
+				setup_raster_triangle(&frame->triangles[frame->triangle_count++], top_left, bottom_left, top_right, 1.0f, 1.0f, 1.0f);
+				setup_raster_triangle(&frame->triangles[frame->triangle_count++], top_right, bottom_left, bottom_right, 1.0f, 1.0f, 1.0f);
+			}
+		}
+	}
+
+	frame->overdraw_counts = push_array(arena, frame->width * frame->height, uint8_t);
+	memset(frame->overdraw_counts, 0, frame->width * frame->height * sizeof(uint8_t));
+	// Nothing gets depth tested (or textured) in this mode
+	frame->tile_depth_ranges = NULL;
+	frame->visibility_buffer = NULL;
+}
+
+// Visualizes the overdraw counts into the frame's pixels and reports any pixels that weren't
+// covered exactly once.
+void resolve_watertight_test(RenderFrame *frame) {
+	int unwritten_count = 0;
+	int overdrawn_count = 0;
+	for (int i = 0; i < frame->width * frame->height; i++) {
+		uint8_t count = frame->overdraw_counts[i];
+		if (count == 0) {
+			frame->pixels[i] = WATERTIGHT_UNWRITTEN_COLOR;
+			unwritten_count++;
+		} else if (count == 1) {
+			frame->pixels[i] = WATERTIGHT_WRITTEN_COLOR;
+		} else {
+			frame->pixels[i] = WATERTIGHT_OVERDRAWN_COLOR;
+			overdrawn_count++;
+		}
+	}
+	if (unwritten_count || overdrawn_count) {
+		printf(
+			"Watertight test FAILED (%u triangles): %d pixels unwritten, %d pixels overdrawn\n",
+			frame->triangle_count, unwritten_count, overdrawn_count
+		);
+	}
+}
+
+//////////////////////////////
+// TRANSFORMS
+//////////////////////////////
+
+// NOTE(mal): Transforms are only rebuilt when something they depend on changes. The view bumps its
+// version every time it's rebuilt, and every object remembers which version of the view (and which
+// position/orientation/scale) its local --> clip transform was composed with.
+
+#define CAMERA_VERTICAL_FOV_DEGREES 90.0f
+#define CAMERA_NEAR_PLANE 1.0f
+#define CAMERA_FAR_PLANE  200.0f
+
+// Rebuilds the view's transforms if the camera or the size of the screen changed.
+void update_view_transforms(ViewTransforms *view, Vec3 camera_world_position, Mat3x3 camera_world_orientation, int width, int height) {
+	if (
+		view->version != 0 &&
+		view->width == width && view->height == height &&
+		memcmp(&view->camera_world_position, &camera_world_position, sizeof(Vec3)) == 0 &&
+		memcmp(&view->camera_world_orientation, &camera_world_orientation, sizeof(Mat3x3)) == 0
+	) {
+		return;
+	}
+	view->camera_world_position    = camera_world_position;
+	view->camera_world_orientation = camera_world_orientation;
+	view->width  = width;
+	view->height = height;
+
+	Mat4x4 world_to_opengl_coordinates = {
+		.rows = {
+			[0][0] = 1,
+			[1][1] = 1,
+			[2][2] = -1, // flip z so that +z points out of screen
+			[3][3] = 1,
+		}
+	};
+
+	// NOTE(mal): The camera's orientation is a rotation, so the generic affine inverse is overkill
+	// (the inverse of a rotation is just its transpose), but this only happens when the camera moves.
+	Mat4x4 camera_to_world = mat4x4_create_local_to_world(camera_world_position, camera_world_orientation, 1.0f);
+	Mat4x4 world_to_camera = mat4x4_inverse_affine(camera_to_world);
+
+	// Translate from world RHS (X+ right, Y+ up, Z+ into) to OpenGL-style RHS
+	world_to_camera = mult_mat4x4_mat4x4(world_to_opengl_coordinates, world_to_camera);
+
+	float vert_fov = DEGREES_TO_RADIANS(CAMERA_VERTICAL_FOV_DEGREES);
+	float near = CAMERA_NEAR_PLANE;
+	float far  = CAMERA_FAR_PLANE;
+	float aspect_ratio = (float)width / (float)height;
+	// NOTE(mal): d here is the distance from view origin to the plane onto which we're projecting
+	// R3 points down to R2. Its value is really somewhat arbitrary since any point along the view
+	// space z axis will project to the same point on our 2D image plane (given that d > 0... d < 0
+	// will result in a flipped image). However, setting it to the cotangent of half the vertical
+	// fov does mean that any point which intersects at the top/bottom of our view frustum will map
+	// the Y component to 1/-1, which is very convenient for mapping into a unit cube (NDC space)
+	// which we'll use for clipping and eventually conversion to screen space. It just means that we
+	// don't have to do an extra division later to normalize our coordinates to be in the range [-1, 1].
+	// See Essential Math 7.3.5 p246 for this derivation of d.
+	// Another insight: we are solving for d such that the half height of our 2D image plane is 1
+	// unit. This is why we divide our vert_fov in half -- because we're just considering one half of
+	// our Y frustum. Also recall that coordinates in NDC space are in range [-1, 1].
+	float d = (float)(1.0f / tan(vert_fov / 2.0f));
+
+	// NOTE(mal): A pure form of the perspective projection matrix just performs a division of x and
+	// y coordinates by z (using perspective divide with w). More useful forms actually will also
+	// scale x,y into NDC range via d and the aspect ratio, and will also remap Z into NDC depth
+	// range via the near and far plane values.
+	// NOTE(mal): If we were not using d and aspect_ratio we would do X component NDC mapping using
+	// left and right values of the frustum planes similar to how we're using near and far.
+
+	// Set up OpenGL-style perspective transform matrix
+	Mat4x4 perspective = {
+		.rows = {
+			// NOTE(mal): We account for the fact here that pixels aren't necessarily square and that the
+			// horizontal FOV may differ from the vertical FOV.
+			{ d / aspect_ratio, 0, 0,                              0,                                    },
+			{ 0,                d, 0,                              0,                                    },
+			// Map depth [-near, -far] (because we look down -z in RHS view space) to [-1, 1].
+			// NOTE(mal): That this does NOT clip or cull vertices! If a vertex depth < near or depth > far
+			// then it just gets assigned an NDC Z value of -1 or 1, respectively.
+			{ 0,                0, -((far + near) / (far - near)), -((2.0f * far * near) / (far - near)) },
+			{ 0,                0, -1,                             0                                     },
+		}
+	};
+
+	// NDC ranges from [-1, -1] to [1, 1]
+	// We want to map to our screen, which is from [0, 0] to [width, height], and where +y is down
+
+	float half_width = width / 2.0f;
+	float half_height = height / 2.0f;
+	float screen_offset_x = 0.0f;
+	float screen_offset_y = 0.0f;
+	// z is a special case since we want to use it for depth testing later.
+	// We want it to range from [0, depth] where depth usually = 1.
+	float depth = 1.0f;
+	float half_depth = depth / 2;
+	Mat4x4 ndc_to_screen = {
+		.rows = {
+			{ half_width, 0,            0,          half_width + screen_offset_x  },
+			{ 0,          -half_height, 0,          half_height + screen_offset_y },
+			{ 0,          0,            half_depth, half_depth                    },
+			{ 0,          0,            0,          1                             },
+		}
+	};
+
+	view->world_to_clip = mult_mat4x4_mat4x4(perspective, world_to_camera);
+	view->ndc_to_screen = ndc_to_screen;
+	view->version++;
+}
+
+// Returns the object's local --> clip transform, only recomposing it if the object or the view
+// changed since the last call with this cache.
+Mat4x4 *compose_local_to_clip(TransformCache *cache, ViewTransforms *view, Vec3 world_position, Mat3x3 world_orientation, float scale) {
+	if (
+		cache->view_version != view->version ||
+		cache->scale != scale ||
+		memcmp(&cache->world_position, &world_position, sizeof(Vec3)) != 0 ||
+		memcmp(&cache->world_orientation, &world_orientation, sizeof(Mat3x3)) != 0
+	) {
+		cache->world_position    = world_position;
+		cache->world_orientation = world_orientation;
+		cache->scale             = scale;
+		cache->view_version      = view->version;
+		Mat4x4 local_to_world = mat4x4_create_local_to_world(world_position, world_orientation, scale);
+		cache->local_to_clip  = mult_mat4x4_mat4x4(view->world_to_clip, local_to_world);
+	}
+	return &cache->local_to_clip;
+}
+
+//////////////////////////////
+// GEOMETRY (MESH SUBMISSION)
+//////////////////////////////
+
+// NOTE(mal): Each plane can add at most one vertex to a convex polygon, so a triangle clipped against
+// the six frustum planes has at most 3 + 6 vertices.
+#define CLIPPED_TRIANGLE_MAX_VERTICES 9
+// Upper bound on the number of (post clipping) triangles the rasterizer gets in a single frame.
+#define MAX_FRAME_TRIANGLES (64 * 1024)
+
+#define STRESS_MESH_CELLS 128
+
+void mesh_build_position_streams(Mesh *mesh, MemoryArena *arena) {
+	uint32_t padded_count = VERTEX_BATCH_PADDED_COUNT(mesh->vertex_count);
+	mesh->positions_x = push_array(arena, padded_count, float);
+	mesh->positions_y = push_array(arena, padded_count, float);
+	mesh->positions_z = push_array(arena, padded_count, float);
+	for (uint32_t i = 0; i < padded_count; i++) {
+		bool is_padding = i >= mesh->vertex_count;
+		ASSERT(is_padding || mesh->vertices[i].position.w == 1.0f);
+		mesh->positions_x[i] = is_padding ? 0.0f : mesh->vertices[i].position.x;
+		mesh->positions_y[i] = is_padding ? 0.0f : mesh->vertices[i].position.y;
+		mesh->positions_z[i] = is_padding ? 0.0f : mesh->vertices[i].position.z;
+	}
+}
+
+// NOTE(mal): A vertex is inside a plane if w + sign * coordinate >= 0, matching
+// clip_sutherland_hodgeman.
+uint8_t compute_outcode(float x, float y, float z, float w) {
+	uint8_t result = 0;
+	if (x >  w) result |= OUTCODE_POSITIVE_X;
+	if (x < -w) result |= OUTCODE_NEGATIVE_X;
+	if (y >  w) result |= OUTCODE_POSITIVE_Y;
+	if (y < -w) result |= OUTCODE_NEGATIVE_Y;
+	if (z >  w) result |= OUTCODE_POSITIVE_Z;
+	if (z < -w) result |= OUTCODE_NEGATIVE_Z;
+	if (fabsf(x) > GUARD_BAND_EXTENT * w) result |= OUTCODE_GUARD_BAND_X;
+	if (fabsf(y) > GUARD_BAND_EXTENT * w) result |= OUTCODE_GUARD_BAND_Y;
+	return result;
+}
+
+// Transforms the mesh's local space positions by local_to_clip into out, which must have room for
+// VERTEX_BATCH_PADDED_COUNT(mesh->vertex_count) vertices.
+#define TRANSFORM_VERTICES_FUNCTION_PARAMS (Mat4x4 *local_to_clip, Mesh *mesh, ClipPositions *out)
+typedef void (*TransformVerticesFunction) TRANSFORM_VERTICES_FUNCTION_PARAMS;
+
+// The reference implementation, one vertex at a time.
+void transform_vertices_scalar TRANSFORM_VERTICES_FUNCTION_PARAMS {
+	float (*m)[4] = local_to_clip->rows;
+	for (uint32_t i = 0; i < mesh->vertex_count; i++) {
+		float x = mesh->positions_x[i];
+		float y = mesh->positions_y[i];
+		float z = mesh->positions_z[i];
+		out->x[i] = m[0][0] * x + m[0][1] * y + m[0][2] * z + m[0][3];
+		out->y[i] = m[1][0] * x + m[1][1] * y + m[1][2] * z + m[1][3];
+		out->z[i] = m[2][0] * x + m[2][1] * y + m[2][2] * z + m[2][3];
+		out->w[i] = m[3][0] * x + m[3][1] * y + m[3][2] * z + m[3][3];
+		out->outcodes[i] = compute_outcode(out->x[i], out->y[i], out->z[i], out->w[i]);
+	}
+}
+
+#ifdef RASTER_SIMD_X64
+// 4 vertices at a time.
+void transform_vertices_sse2 TRANSFORM_VERTICES_FUNCTION_PARAMS {
+	__m128 m[4][4];
+	for (int r = 0; r < 4; r++) {
+		for (int c = 0; c < 4; c++) {
+			m[r][c] = _mm_set1_ps(local_to_clip->rows[r][c]);
+		}
+	}
+	const __m128 negative_zero     = _mm_set1_ps(-0.0f);
+	const __m128 guard_band_extent = _mm_set1_ps(GUARD_BAND_EXTENT);
+
+	for (uint32_t i = 0; i < mesh->vertex_count; i += 4) {
+		__m128 x = _mm_loadu_ps(mesh->positions_x + i);
+		__m128 y = _mm_loadu_ps(mesh->positions_y + i);
+		__m128 z = _mm_loadu_ps(mesh->positions_z + i);
+		__m128 clip[4];
+		for (int r = 0; r < 4; r++) {
+			clip[r] = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(m[r][0], x), _mm_mul_ps(m[r][1], y)),
+				_mm_add_ps(_mm_mul_ps(m[r][2], z), m[r][3])
+			);
+		}
+		_mm_storeu_ps(out->x + i, clip[0]);
+		_mm_storeu_ps(out->y + i, clip[1]);
+		_mm_storeu_ps(out->z + i, clip[2]);
+		_mm_storeu_ps(out->w + i, clip[3]);
+
+		// Each compare gives an all ones lane per vertex outside that plane, which gets masked down to
+		// the plane's bit. The 32 bit lanes are then narrowed down to the 4 outcode bytes.
+		__m128 negative_w = _mm_xor_ps(clip[3], negative_zero);
+		__m128i outcodes = _mm_setzero_si128();
+		for (int axis = 0; axis < 3; axis++) {
+			__m128i positive_bit = _mm_set1_epi32(OUTCODE_POSITIVE_X << (2 * axis));
+			__m128i negative_bit = _mm_set1_epi32(OUTCODE_NEGATIVE_X << (2 * axis));
+			__m128i outside_positive = _mm_castps_si128(_mm_cmpgt_ps(clip[axis], clip[3]));
+			__m128i outside_negative = _mm_castps_si128(_mm_cmplt_ps(clip[axis], negative_w));
+			outcodes = _mm_or_si128(outcodes, _mm_and_si128(outside_positive, positive_bit));
+			outcodes = _mm_or_si128(outcodes, _mm_and_si128(outside_negative, negative_bit));
+		}
+		__m128 guard_band_w = _mm_mul_ps(clip[3], guard_band_extent);
+		for (int axis = 0; axis < 2; axis++) {
+			__m128i guard_band_bit = _mm_set1_epi32(OUTCODE_GUARD_BAND_X << axis);
+			__m128  magnitude      = _mm_andnot_ps(negative_zero, clip[axis]);
+			__m128i outside        = _mm_castps_si128(_mm_cmpgt_ps(magnitude, guard_band_w));
+			outcodes = _mm_or_si128(outcodes, _mm_and_si128(outside, guard_band_bit));
+		}
+		// NOTE(mal): Outcodes are at most 0xFF, which survives the signed saturation from 32 to 16 bits
+		// and the unsigned saturation from 16 to 8 bits.
+		outcodes = _mm_packs_epi32(outcodes, outcodes);
+		outcodes = _mm_packus_epi16(outcodes, outcodes);
+		int32_t packed_outcodes = _mm_cvtsi128_si32(outcodes);
+		memcpy(out->outcodes + i, &packed_outcodes, 4);
+	}
+}
+
+// 8 vertices at a time.
+TARGET_AVX2 void transform_vertices_avx2 TRANSFORM_VERTICES_FUNCTION_PARAMS {
+	__m256 m[4][4];
+	for (int r = 0; r < 4; r++) {
+		for (int c = 0; c < 4; c++) {
+			m[r][c] = _mm256_set1_ps(local_to_clip->rows[r][c]);
+		}
+	}
+	const __m256 negative_zero     = _mm256_set1_ps(-0.0f);
+	const __m256 guard_band_extent = _mm256_set1_ps(GUARD_BAND_EXTENT);
+
+	for (uint32_t i = 0; i < mesh->vertex_count; i += 8) {
+		__m256 x = _mm256_loadu_ps(mesh->positions_x + i);
+		__m256 y = _mm256_loadu_ps(mesh->positions_y + i);
+		__m256 z = _mm256_loadu_ps(mesh->positions_z + i);
+		__m256 clip[4];
+		for (int r = 0; r < 4; r++) {
+			clip[r] = _mm256_add_ps(
+				_mm256_add_ps(_mm256_mul_ps(m[r][0], x), _mm256_mul_ps(m[r][1], y)),
+				_mm256_add_ps(_mm256_mul_ps(m[r][2], z), m[r][3])
+			);
+		}
+		_mm256_storeu_ps(out->x + i, clip[0]);
+		_mm256_storeu_ps(out->y + i, clip[1]);
+		_mm256_storeu_ps(out->z + i, clip[2]);
+		_mm256_storeu_ps(out->w + i, clip[3]);
+
+		// Same as the SSE2 kernel
+		__m256 negative_w = _mm256_xor_ps(clip[3], negative_zero);
+		__m256i outcodes = _mm256_setzero_si256();
+		for (int axis = 0; axis < 3; axis++) {
+			__m256i positive_bit = _mm256_set1_epi32(OUTCODE_POSITIVE_X << (2 * axis));
+			__m256i negative_bit = _mm256_set1_epi32(OUTCODE_NEGATIVE_X << (2 * axis));
+			__m256i outside_positive = _mm256_castps_si256(_mm256_cmp_ps(clip[axis], clip[3], _CMP_GT_OQ));
+			__m256i outside_negative = _mm256_castps_si256(_mm256_cmp_ps(clip[axis], negative_w, _CMP_LT_OQ));
+			outcodes = _mm256_or_si256(outcodes, _mm256_and_si256(outside_positive, positive_bit));
+			outcodes = _mm256_or_si256(outcodes, _mm256_and_si256(outside_negative, negative_bit));
+		}
+		__m256 guard_band_w = _mm256_mul_ps(clip[3], guard_band_extent);
+		for (int axis = 0; axis < 2; axis++) {
+			__m256i guard_band_bit = _mm256_set1_epi32(OUTCODE_GUARD_BAND_X << axis);
+			__m256  magnitude      = _mm256_andnot_ps(negative_zero, clip[axis]);
+			__m256i outside        = _mm256_castps_si256(_mm256_cmp_ps(magnitude, guard_band_w, _CMP_GT_OQ));
+			outcodes = _mm256_or_si256(outcodes, _mm256_and_si256(outside, guard_band_bit));
+		}
+		__m128i outcodes_narrow = _mm_packs_epi32(_mm256_castsi256_si128(outcodes), _mm256_extracti128_si256(outcodes, 1));
+		outcodes_narrow = _mm_packus_epi16(outcodes_narrow, outcodes_narrow);
+		_mm_storel_epi64((__m128i *)(out->outcodes + i), outcodes_narrow);
+	}
+}
+#endif
+
+// NOTE(mal): Indexed by RasterKernel so that the vertex transform uses the same instruction set as
+// the rasterizer and both get A/B'd together.
+TransformVerticesFunction transform_vertices_functions[RASTER_KERNEL_COUNT] = {
+	[RASTER_KERNEL_SCALAR] = transform_vertices_scalar,
+#ifdef RASTER_SIMD_X64
+	[RASTER_KERNEL_SSE2]   = transform_vertices_sse2,
+	[RASTER_KERNEL_AVX2]   = transform_vertices_avx2,
+#endif
+};
+
+#ifdef PROFILING_ENABLED
+// Indexed like clip_polygon's loops: [plane_index][plane_sign > 0]
+const char *clip_pass_zone_names[3][2] = {
+	{ "clip +x", "clip -x" },
+	{ "clip +y", "clip -y" },
+	{ "clip far", "clip near" },
+};
+#endif
+
+// Clips a convex polygon in homogeneous clip space against the planes in planes (a set of Outcode
+// bits). The polygon starts out in buffer_a and gets ping ponged between the two buffers (both of
+// which must hold CLIPPED_TRIANGLE_MAX_VERTICES). Returns whichever buffer holds the result, with
+// the result's vertex count written back into vertex_count (less than 3 if nothing was left).
+// The guard band bits clip both sides of their axis against the guard band.
+// NOTE(mal): Passing the union of the polygon's outcodes is enough: if every vertex is inside a
+// plane then so is every point on the polygon, including any clip points generated by the other
+// planes, so clipping against it would just copy the polygon.
+// NOTE(mal): See "Essential Math" 7.4.3 and 7.4.4 about clipping
+Vertex *clip_polygon(Vertex *buffer_a, Vertex *buffer_b, size_t *vertex_count, uint8_t planes) {
+	#define SWAP_POINTERS(Type, a, b) {\
+		Type *tmp = (a);\
+		(a) = (b);\
+		(b) = tmp;\
+	}
+
+	Vertex *input  = buffer_a;
+	Vertex *output = buffer_b;
+	size_t  count  = *vertex_count;
+	// +x, -x, +y, -y, +z, -z
+	for (int plane_index = 0; plane_index < 3; plane_index++) {
+		uint8_t guard_band_plane = plane_index < 2 ? OUTCODE_GUARD_BAND_X << plane_index : 0;
+		for (int plane_sign = -1; plane_sign <= 1; plane_sign += 2) {
+			uint8_t frustum_plane = (plane_sign < 0 ? OUTCODE_POSITIVE_X : OUTCODE_NEGATIVE_X) << (2 * plane_index);
+			float extent;
+			if (planes & guard_band_plane) {
+				extent = GUARD_BAND_EXTENT;
+			} else if (planes & frustum_plane) {
+				extent = 1.0f;
+			} else {
+				continue;
+			}
+			if (count < 3) {
+				*vertex_count = 0;
+				return input;
+			}
+			PROFILE_BEGIN(clip_pass_zone_names[plane_index][plane_sign > 0]);
+			count = clip_sutherland_hodgeman(plane_index, plane_sign, extent, input, count, output);
+			PROFILE_END(clip_pass_zone_names[plane_index][plane_sign > 0]);
+			SWAP_POINTERS(Vertex, input, output);
+		}
+	}
+
+	*vertex_count = count;
+	return input;
+}
+
+// Homogeneous clip --> NDC --> screen, in place. Returns 1/w for perspective correct interpolation.
+float project_vertex_to_screen(RenderFrame *frame, Vertex *vertex) {
+	// NOTE(mal): After perspective projection and before perspective divide, the w
+	// component IS our view-space Z (depth) coordinate!
+	float reciprocal_w = 1.0f / vertex->position.w;
+	// perspective divide: homogeneous clip --> NDC
+	vertex->position.x *= reciprocal_w;
+	vertex->position.y *= reciprocal_w;
+	vertex->position.z *= reciprocal_w;
+	vertex->position.w *= reciprocal_w;
+	// NDC --> screen
+	vertex->position = mult_mat4x4_vec4(frame->ndc_to_screen, vertex->position);
+	// NOTE(mal): Reverse Z. Screen space z crams almost all of its float precision right up
+	// against the near plane. near/w instead maps the near plane to 1 and goes to 0 at
+	// infinity, and since float precision increases towards 0 that roughly cancels out the 1/w
+	// distribution, leaving precision nearly uniform across the whole depth range.
+	if (frame->reverse_z) {
+		vertex->position.z = frame->near_plane * reciprocal_w;
+	}
+	return reciprocal_w;
+}
+
+// Mesh vertex i's attributes along with its transformed position
+Vertex get_clip_vertex(Mesh *mesh, ClipPositions *clip_positions, uint32_t i) {
+	Vertex result = mesh->vertices[i];
+	result.position = (Vec4){
+		.x = clip_positions->x[i],
+		.y = clip_positions->y[i],
+		.z = clip_positions->z[i],
+		.w = clip_positions->w[i],
+	};
+	return result;
+}
+
+// Sets up a (convex, screen space) polygon for rasterization as a triangle fan, minus any triangles
+// that cull_triangle rejects. Returns false if the frame has no room left for it.
+bool append_triangle_fan(RenderFrame *frame, Vertex *vertices, float *reciprocal_depths, size_t vertex_count, CullMode cull_mode) {
+	// A fan of n vertices has n - 2 triangles
+	if (frame->triangle_count + (vertex_count - 2) > frame->triangle_capacity) {
+		ASSERT_MSG(false, "Ran out of room for triangles this frame");
+		return false;
+	}
+
+	size_t triangle_fan_center_index = 0;
+	for (size_t v = 2; v < vertex_count; v++) {
+		// Also fix the winding order that we've screwed up by transforming from homogenous clip -->
+		// NDC --> screen.
+		// TODO(mal): Maybe just change the edge function to assume CCW order instead of CW? Then
+		// we don't have to change the order of our vertices here.
+		size_t i0 = v, i1 = v - 1, i2 = triangle_fan_center_index;
+		TriangleCullResult cull_result = cull_triangle(&vertices[i0], &vertices[i1], &vertices[i2], cull_mode);
+		if (cull_result == TRIANGLE_REJECT) {
+			continue;
+		}
+		if (cull_result == TRIANGLE_ACCEPT_FLIPPED) {
+			i1 = triangle_fan_center_index;
+			i2 = v - 1;
+		}
+
+		RasterTriangle *triangle = &frame->triangles[frame->triangle_count++];
+		setup_raster_triangle(
+			triangle,
+			&vertices[i0], &vertices[i1], &vertices[i2],
+			reciprocal_depths[i0], reciprocal_depths[i1], reciprocal_depths[i2]
+		);
+
+		// With guard band clipping triangles can extend past the screen (and even miss it entirely
+		// if they only cover its corners from the outside).
+		if (
+			triangle->xmax < 0 || triangle->xmin >= frame->width ||
+			triangle->ymax < 0 || triangle->ymin >= frame->height
+		) {
+			frame->triangle_count--;
+			continue;
+		}
+		// NOTE(mal): The AABB is inclusive, so the last pixel on screen is width - 1 (height - 1).
+		if (triangle->xmin < 0) triangle->xmin = 0;
+		if (triangle->xmax > frame->width - 1) triangle->xmax = frame->width - 1;
+		if (triangle->ymin < 0) triangle->ymin = 0;
+		if (triangle->ymax > frame->height - 1) triangle->ymax = frame->height - 1;
+	}
+	return true;
+}
+
+// Runs a mesh through vertex transform, clipping, projection and triangle setup, appending the
+// resulting triangles to the frame to be binned. Only triangles that straddle the frustum (or with
+// guard band clipping, the near/far planes or the guard band) get clipped: the vertices' outcodes
+// trivially accept the ones fully inside and reject the ones fully outside (of a single plane).
+// NOTE(mal): Every vertex is transformed exactly once up front, after which the transformed vertex
+// streams act as a post-transform cache indexed by the mesh's indices: vertices shared between
+// triangles aren't transformed again for each triangle that uses them.
+void submit_mesh(RenderFrame *frame, MemoryArena *arena, Mesh *mesh, Mat4x4 *local_to_clip) {
+	PROFILE_BEGIN("vertex transform");
+	uint32_t padded_count = VERTEX_BATCH_PADDED_COUNT(mesh->vertex_count);
+	ClipPositions clip_positions = {
+		.x        = push_array(arena, padded_count, float),
+		.y        = push_array(arena, padded_count, float),
+		.z        = push_array(arena, padded_count, float),
+		.w        = push_array(arena, padded_count, float),
+		.outcodes = push_array(arena, padded_count, uint8_t),
+	};
+	transform_vertices_functions[frame->raster_kernel](local_to_clip, mesh, &clip_positions);
+
+	// Planes that triangles have to be clipped against. Anything inside all of them gets rasterized
+	// as is.
+	uint8_t clip_planes = frame->guard_band_clipping
+		? OUTCODE_NEAR_FAR_PLANES | OUTCODE_GUARD_BAND_PLANES
+		: OUTCODE_FRUSTUM_PLANES;
+
+	// Vertices that don't need clipping get projected up front (once each) for the triangles that
+	// don't need clipping to use as is.
+	Vertex *screen_vertices = push_array(arena, mesh->vertex_count, Vertex);
+	float *reciprocal_depths = push_array(arena, mesh->vertex_count, float);
+	for (uint32_t i = 0; i < mesh->vertex_count; i++) {
+		if (!(clip_positions.outcodes[i] & clip_planes)) {
+			screen_vertices[i] = get_clip_vertex(mesh, &clip_positions, i);
+			reciprocal_depths[i] = project_vertex_to_screen(frame, &screen_vertices[i]);
+		}
+	}
+	PROFILE_END("vertex transform");
+
+	// NOTE(mal): Includes clipping (which has zones of its own for each plane) and culling.
+	PROFILE_BEGIN("triangle setup");
+	for (uint32_t i = 0; i + 2 < mesh->index_count; i += 3) {
+		uint32_t *indices = &mesh->indices[i];
+		ASSERT(indices[0] < mesh->vertex_count);
+		ASSERT(indices[1] < mesh->vertex_count);
+		ASSERT(indices[2] < mesh->vertex_count);
+		uint8_t outcode_0 = clip_positions.outcodes[indices[0]];
+		uint8_t outcode_1 = clip_positions.outcodes[indices[1]];
+		uint8_t outcode_2 = clip_positions.outcodes[indices[2]];
+
+		// Trivial reject: every vertex is outside the same side of the frustum.
+		if (outcode_0 & outcode_1 & outcode_2 & OUTCODE_FRUSTUM_PLANES) {
+			continue;
+		}
+
+		// Trivial accept: every vertex is inside every plane that gets clipped against.
+		uint8_t outcode_union = (outcode_0 | outcode_1 | outcode_2) & clip_planes;
+		if (!outcode_union) {
+			Vertex triangle_vertices[3] = {
+				screen_vertices[indices[0]], screen_vertices[indices[1]], screen_vertices[indices[2]]
+			};
+			float triangle_reciprocal_depths[3] = {
+				reciprocal_depths[indices[0]], reciprocal_depths[indices[1]], reciprocal_depths[indices[2]]
+			};
+			if (!append_triangle_fan(frame, triangle_vertices, triangle_reciprocal_depths, 3, mesh->cull_mode)) {
+				break;
+			}
+			continue;
+		}
+
+		// NOTE(mal): Triangles get clipped individually, but neighbors still end up with identical
+		// vertices along their shared edges since clip_sutherland_hodgeman always generates clip
+		// points in the same direction regardless of which way round an edge is walked.
+		Vertex clip_buffer_a[CLIPPED_TRIANGLE_MAX_VERTICES];
+		Vertex clip_buffer_b[CLIPPED_TRIANGLE_MAX_VERTICES];
+		for (int v = 0; v < 3; v++) {
+			clip_buffer_a[v] = get_clip_vertex(mesh, &clip_positions, indices[v]);
+		}
+		size_t clipped_vertex_count = 3;
+		Vertex *clipped_vertices = clip_polygon(clip_buffer_a, clip_buffer_b, &clipped_vertex_count, outcode_union);
+		if (clipped_vertex_count < 3) {
+			continue;
+		}
+
+		float clipped_reciprocal_depths[CLIPPED_TRIANGLE_MAX_VERTICES];
+		for (size_t v = 0; v < clipped_vertex_count; v++) {
+			clipped_reciprocal_depths[v] = project_vertex_to_screen(frame, &clipped_vertices[v]);
+		}
+		if (!append_triangle_fan(frame, clipped_vertices, clipped_reciprocal_depths, clipped_vertex_count, mesh->cull_mode)) {
+			break;
+		}
+	}
+	PROFILE_END("triangle setup");
+}
+
+// A sheet of cells_x by cells_y quads spanning [-half_width, half_width] in x and [-1, 1] in y, facing
+// the same way as the square, optionally made wavy along z. The texture is stretched over the whole
+// sheet, times uv_scale.
+Mesh create_grid_mesh(MemoryArena *arena, int cells_x, int cells_y, float half_width, float uv_scale, float wave_height) {
+	int vertex_count_x = cells_x + 1;
+	int vertex_count_y = cells_y + 1;
+	Mesh mesh = {0};
+	mesh.cull_mode    = CULL_MODE_BACK;
+	mesh.vertex_count = vertex_count_x * vertex_count_y;
+	mesh.vertices     = push_array(arena, mesh.vertex_count, Vertex);
+	for (int j = 0; j < vertex_count_y; j++) {
+		for (int i = 0; i < vertex_count_x; i++) {
+			float u = (float)i / cells_x;
+			float v = (float)j / cells_y;
+			float x = (u * 2.0f - 1.0f) * half_width;
+			float y = v * 2.0f - 1.0f;
+			mesh.vertices[i + j * vertex_count_x] = (Vertex){
+				.position = { .x = x, .y = y, .z = wave_height * sinf(x * 4.0f * PI) * cosf(y * 3.0f * PI), .w = 1 },
+				.color = -1,
+				.tx_u = u * uv_scale, .tx_v = (1.0f - v) * uv_scale,
+			};
+		}
+	}
+
+	mesh.index_count = cells_x * cells_y * 6;
+	mesh.indices     = push_array(arena, mesh.index_count, uint32_t);
+	uint32_t *index = mesh.indices;
+	for (int j = 0; j < cells_y; j++) {
+		for (int i = 0; i < cells_x; i++) {
+			uint32_t bottom_left  = (i + 0) + (j + 0) * vertex_count_x;
+			uint32_t top_left     = (i + 0) + (j + 1) * vertex_count_x;
+			uint32_t top_right    = (i + 1) + (j + 1) * vertex_count_x;
+			uint32_t bottom_right = (i + 1) + (j + 0) * vertex_count_x;
+			// Same winding as the square
+			*index++ = bottom_left; *index++ = top_left;  *index++ = top_right;
+			*index++ = bottom_left; *index++ = top_right; *index++ = bottom_right;
+		}
+	}
+
+	mesh_build_position_streams(&mesh, arena);
+	return mesh;
+}
+
+// A finely tessellated wavy sheet for pushing lots of small triangles through the pipeline.
+// Spans [-1, 1] in x and y and faces the same way as the square.
+Mesh create_stress_mesh(MemoryArena *arena) {
+	return create_grid_mesh(arena, STRESS_MESH_CELLS, STRESS_MESH_CELLS, 1.0f, 1.0f, 0.05f);
+}
+
+//////////////////////////////
+// BENCHMARK SCENES
+//////////////////////////////
+// NOTE(mal): Every scene is looked at from the origin with the default camera and, other than
+// near clip, sits BENCHMARK_SCENE_DEPTH in front of it, scaled so that [-1, 1] in y covers the screen
+// top to bottom. The meshes span BENCHMARK_ASPECT_RATIO in x, so on a 16:9 offscreen buffer they
+// cover exactly the whole screen and nothing more.
+
+#define BENCHMARK_ASPECT_RATIO (16.0f / 9.0f)
+#define BENCHMARK_SCENE_DEPTH 10.0f
+#define BENCHMARK_SMALL_TRIANGLE_CELLS_X 94 // 94 x 53 cells, a little under 10k triangles
+#define BENCHMARK_SMALL_TRIANGLE_CELLS_Y 53
+#define BENCHMARK_NEAR_CLIP_TRIANGLES 1024
+#define BENCHMARK_OVERDRAW_LAYERS 8
+#define BENCHMARK_MINIFIED_TILES_X 32 // each tile shows the whole texture
+#define BENCHMARK_MINIFIED_TILES_Y 18
+
+// Like create_grid_mesh, except that every cell gets its own four vertices and the whole texture.
+Mesh create_tiled_quads_mesh(MemoryArena *arena, int tiles_x, int tiles_y, float half_width) {
+	Mesh mesh = {0};
+	mesh.cull_mode    = CULL_MODE_BACK;
+	mesh.vertex_count = tiles_x * tiles_y * 4;
+	mesh.vertices     = push_array(arena, mesh.vertex_count, Vertex);
+	mesh.index_count  = tiles_x * tiles_y * 6;
+	mesh.indices      = push_array(arena, mesh.index_count, uint32_t);
+	Vertex   *vertex = mesh.vertices;
+	uint32_t *index  = mesh.indices;
+	float tile_width  = 2.0f * half_width / tiles_x;
+	float tile_height = 2.0f / tiles_y;
+	for (int j = 0; j < tiles_y; j++) {
+		for (int i = 0; i < tiles_x; i++) {
+			float left   = -half_width + i * tile_width;
+			float bottom = -1.0f + j * tile_height;
+			uint32_t bottom_left = (uint32_t)(vertex - mesh.vertices);
+			*vertex++ = (Vertex){ .position = { .x = left,              .y = bottom,               .w = 1 }, .color = -1, .tx_u = 0.0f, .tx_v = 1.0f };
+			*vertex++ = (Vertex){ .position = { .x = left,              .y = bottom + tile_height, .w = 1 }, .color = -1, .tx_u = 0.0f, .tx_v = 0.0f };
+			*vertex++ = (Vertex){ .position = { .x = left + tile_width, .y = bottom + tile_height, .w = 1 }, .color = -1, .tx_u = 1.0f, .tx_v = 0.0f };
+			*vertex++ = (Vertex){ .position = { .x = left + tile_width, .y = bottom,               .w = 1 }, .color = -1, .tx_u = 1.0f, .tx_v = 1.0f };
+			// Same winding as the square
+			*index++ = bottom_left; *index++ = bottom_left + 1; *index++ = bottom_left + 2;
+			*index++ = bottom_left; *index++ = bottom_left + 2; *index++ = bottom_left + 3;
+		}
+	}
+
+	mesh_build_position_streams(&mesh, arena);
+	return mesh;
+}
+
+// Long slivers side by side, each with its tip behind the camera and its base far in front of it,
+// so that every one of them has to be clipped against the near plane. Placed directly in world
+// space (i.e. meant to be drawn at the origin with a scale of 1).
+Mesh create_near_clip_mesh(MemoryArena *arena, int triangle_count) {
+	Mesh mesh = {0};
+	// Some slivers end up facing away from the camera, we want those clipped too.
+	mesh.cull_mode    = CULL_MODE_NONE;
+	mesh.vertex_count = triangle_count * 3;
+	mesh.vertices     = push_array(arena, mesh.vertex_count, Vertex);
+	mesh.index_count  = triangle_count * 3;
+	mesh.indices      = push_array(arena, mesh.index_count, uint32_t);
+	const float tip_z  = -5.0f;
+	const float base_z = 30.0f;
+	// Just about the width of the view at the base
+	float base_half_width = base_z * BENCHMARK_ASPECT_RATIO;
+	float base_width      = 2.0f * base_half_width / triangle_count;
+	for (int t = 0; t < triangle_count; t++) {
+		float base_left = -base_half_width + t * base_width;
+		float tip_x = base_left * 0.1f;
+		float tip_y = (t % 2) ? 2.0f : -2.0f;
+		float u = (float)t / triangle_count;
+		Vertex *vertices = &mesh.vertices[t * 3];
+		vertices[0] = (Vertex){ .position = { .x = tip_x,                  .y = tip_y, .z = tip_z,  .w = 1 }, .color = -1, .tx_u = u, .tx_v = 0.0f };
+		vertices[1] = (Vertex){ .position = { .x = base_left,              .y = 0.0f,  .z = base_z, .w = 1 }, .color = -1, .tx_u = u, .tx_v = 1.0f };
+		vertices[2] = (Vertex){ .position = { .x = base_left + base_width, .y = 0.0f,  .z = base_z, .w = 1 }, .color = -1, .tx_u = u, .tx_v = 1.0f };
+		mesh.indices[t * 3 + 0] = t * 3 + 0;
+		mesh.indices[t * 3 + 1] = t * 3 + 1;
+		mesh.indices[t * 3 + 2] = t * 3 + 2;
+	}
+
+	mesh_build_position_streams(&mesh, arena);
+	return mesh;
+}
+
+void create_benchmark_meshes(BenchmarkMeshes *meshes, MemoryArena *arena) {
+	meshes->fullscreen_quad = create_grid_mesh(arena, 1, 1, BENCHMARK_ASPECT_RATIO, 1.0f, 0.0f);
+	meshes->small_triangles = create_grid_mesh(
+		arena, BENCHMARK_SMALL_TRIANGLE_CELLS_X, BENCHMARK_SMALL_TRIANGLE_CELLS_Y, BENCHMARK_ASPECT_RATIO, 1.0f, 0.0f
+	);
+	meshes->near_clip = create_near_clip_mesh(arena, BENCHMARK_NEAR_CLIP_TRIANGLES);
+	// A 16th of the texture stretched over the whole screen
+	meshes->texture_magnified = create_grid_mesh(arena, 1, 1, BENCHMARK_ASPECT_RATIO, 1.0f / 16.0f, 0.0f);
+	meshes->texture_minified = create_tiled_quads_mesh(
+		arena, BENCHMARK_MINIFIED_TILES_X, BENCHMARK_MINIFIED_TILES_Y, BENCHMARK_ASPECT_RATIO
+	);
+}
+
+// depth is both the mesh's distance from the camera and its scale (see BENCHMARK SCENES).
+void submit_benchmark_mesh(RenderFrame *frame, MemoryArena *arena, ViewTransforms *view, Mesh *mesh, float depth) {
+	// NOTE(mal): Not worth caching, these get recomposed every frame.
+	TransformCache transform_cache = {0};
+	Mat4x4 *local_to_clip = compose_local_to_clip(
+		&transform_cache, view, (Vec3){ .z = depth }, mat3x3_create_identity(), depth
+	);
+	submit_mesh(frame, arena, mesh, local_to_clip);
+}
+
+void submit_benchmark_scene(RenderFrame *frame, MemoryArena *arena, ViewTransforms *view, BenchmarkMeshes *meshes, GameBenchmarkScene scene) {
+	switch (scene) {
+		case GAME_BENCHMARK_SCENE_FULLSCREEN_QUAD:
+			submit_benchmark_mesh(frame, arena, view, &meshes->fullscreen_quad, BENCHMARK_SCENE_DEPTH);
+			break;
+		case GAME_BENCHMARK_SCENE_SMALL_TRIANGLES:
+			submit_benchmark_mesh(frame, arena, view, &meshes->small_triangles, BENCHMARK_SCENE_DEPTH);
+			break;
+		case GAME_BENCHMARK_SCENE_NEAR_CLIP: {
+			TransformCache transform_cache = {0};
+			Mat4x4 *local_to_clip = compose_local_to_clip(
+				&transform_cache, view, (Vec3){0}, mat3x3_create_identity(), 1.0f
+			);
+			submit_mesh(frame, arena, &meshes->near_clip, local_to_clip);
+		} break;
+		case GAME_BENCHMARK_SCENE_OVERDRAW:
+			// Back to front, so that every layer passes the depth test
+			for (int layer = BENCHMARK_OVERDRAW_LAYERS - 1; layer >= 0; layer--) {
+				submit_benchmark_mesh(frame, arena, view, &meshes->fullscreen_quad, BENCHMARK_SCENE_DEPTH + layer);
+			}
+			break;
+		case GAME_BENCHMARK_SCENE_TEXTURE_MAGNIFIED:
+			submit_benchmark_mesh(frame, arena, view, &meshes->texture_magnified, BENCHMARK_SCENE_DEPTH);
+			break;
+		case GAME_BENCHMARK_SCENE_TEXTURE_MINIFIED:
+			submit_benchmark_mesh(frame, arena, view, &meshes->texture_minified, BENCHMARK_SCENE_DEPTH);
+			break;
+		default:
+			ASSERT_MSG(false, "Unknown benchmark scene");
+			break;
+	}
+}
+
+// 32x32 texel cells, alternating between two greys.
+uint32_t *create_checkerboard_texture(MemoryArena *arena, unsigned width, unsigned height) {
+	uint32_t *pixels = push_array(arena, width * height, uint32_t);
+	for (unsigned y = 0; y < height; y++) {
+		for (unsigned x = 0; x < width; x++) {
+			bool is_light = ((x / 32) + (y / 32)) % 2 == 0;
+			pixels[x + y * width] = is_light ? 0x00C0C0C0 : 0x00404040;
+		}
+	}
+	return pixels;
+}
+
+// NOTE(mal): Enough for everything at 3840x2160: ~33MB of depth buffer, ~66MB of visibility buffer and
+// a few hundred KB of tile depth ranges and bin hashes.
+#define RENDER_TARGET_ARENA_SIZE (100ull * 1024ull * 1024ull)
+#define ASSET_ARENA_SIZE         (8ull * 1024ull * 1024ull)
+
+// (Re)allocates everything in the render target arena if the offscreen buffer changed size.
+void resize_render_targets(GameState *game_state, int width, int height) {
+	if (game_state->render_target_width == width && game_state->render_target_height == height) {
+		return;
+	}
+	game_state->render_target_arena.used = 0;
+	game_state->depth_buffer = push_array(&game_state->render_target_arena, width * height, float);
+	game_state->tile_count_x = (width + RASTER_TILE_WIDTH - 1) / RASTER_TILE_WIDTH;
+	int tile_count_y = (height + RASTER_TILE_HEIGHT - 1) / RASTER_TILE_HEIGHT;
+	game_state->tile_depth_ranges = push_array(
+		&game_state->render_target_arena, game_state->tile_count_x * tile_count_y, TileDepthRange
+	);
+	int bin_count_x = (width  + RENDER_BIN_WIDTH  - 1) / RENDER_BIN_WIDTH;
+	int bin_count_y = (height + RENDER_BIN_HEIGHT - 1) / RENDER_BIN_HEIGHT;
+	game_state->bin_pixel_hashes = push_array(&game_state->render_target_arena, bin_count_x * bin_count_y, uint64_t);
+	game_state->visibility_buffer = push_array(&game_state->render_target_arena, width * height, VisibilitySample);
+	game_state->render_target_width  = width;
+	game_state->render_target_height = height;
+	game_state->depth_buffer_invalid = true;
+	game_state->bin_pixel_hashes_invalid = true;
+}
+
+EXPORT void game_init(GameMemory *memory, int initial_width, int initial_height) {
+	ASSERT(memory->debug_platform_read_entire_file);
+	ASSERT(memory->debug_platform_free_entire_file);
+	ASSERT(memory->render_queue);
+	ASSERT(memory->platform_add_work_queue_entry);
+	ASSERT(memory->platform_complete_all_work);
+
+	GameStorage *storage = (GameStorage *)memory->storage;
+	SimState *sim = &storage->sim;
+	GameState *game_state = &storage->render;
+	size_t persistent_size = sizeof(GameStorage) + RENDER_TARGET_ARENA_SIZE + ASSET_ARENA_SIZE;
+	ASSERT(memory->storage_size > persistent_size);
+	initialize_arena(
+		&game_state->render_target_arena,
+		(uint8_t *)memory->storage + sizeof(GameStorage),
+		RENDER_TARGET_ARENA_SIZE
+	);
+	initialize_arena(
+		&game_state->asset_arena,
+		(uint8_t *)memory->storage + sizeof(GameStorage) + RENDER_TARGET_ARENA_SIZE,
+		ASSET_ARENA_SIZE
+	);
+	initialize_arena(
+		&game_state->frame_arena,
+		(uint8_t *)memory->storage + persistent_size,
+		memory->storage_size - persistent_size
+	);
+
+	// Square in CW winding order
+	// 0: Square bottom left
+	game_state->square.local_vertices[0] = (Vertex){
+		.position = { .x = -1, .y = -1, .w = 1 },
+		.color = -1,
+		.tx_u = 0.0f, .tx_v = 1.0f,
+	};
+	// 1: Square top left
+	game_state->square.local_vertices[1] = (Vertex){
+		.position = { .x = -1, .y = 1, .w = 1 },
+		.color = -1,
+		.tx_u = 0.0f, .tx_v = 0.0f,
+	};
+	// 2: Square top right
+	game_state->square.local_vertices[2] = (Vertex){
+		.position = { .x = 1, .y = 1, .w = 1 },
+		.color = -1,
+		.tx_u = 1.0f, .tx_v = 0.0f,
+	};
+	// 3: Square bottom right
+	game_state->square.local_vertices[3] = (Vertex){
+		.position = { .x = 1, .y = -1, .w = 1 },
+		.color = -1,
+		.tx_u = 1.0f, .tx_v = 1.0f,
+	};
+	
+	// Two triangles: bottom left, top left, top right and bottom left, top right, bottom right
+	uint32_t square_indices[6] = { 0, 1, 2, 0, 2, 3 };
+	memcpy(game_state->square.vertex_list, square_indices, sizeof(square_indices));
+	game_state->square_mesh = (Mesh){
+		.vertices     = game_state->square.local_vertices,
+		.vertex_count = 4,
+		.indices      = game_state->square.vertex_list,
+		.index_count  = 6,
+		.cull_mode    = CULL_MODE_BACK,
+	};
+	mesh_build_position_streams(&game_state->square_mesh, &game_state->asset_arena);
+
+	game_state->stress_mesh = create_stress_mesh(&game_state->asset_arena);
+	create_benchmark_meshes(&game_state->benchmark_meshes, &game_state->asset_arena);
+
+	char *tga_data = (char *)memory->debug_platform_read_entire_file("../testtexture.tga");
+	if (tga_data) {
+		TGA_Header *tga_header = (TGA_Header *)tga_data;
+		ASSERT(tga_header->bitsperpixel == 32);
+		ASSERT_MSG(tga_header->datatypecode == TGA_DATATYPE_RGB, "Test texture TGA is not RGB!");
+		game_state->texture_height = tga_header->height;
+		game_state->texture_width  = tga_header->width;
+		game_state->texture_pixels = (uint32_t *)(tga_data + sizeof(TGA_Header));
+	} else {
+		// NOTE(mal): e.g. running headless on a machine without our assets. A checkerboard of the same
+		// size costs the rasterizer exactly the same to sample.
+		printf("Test texture not found, using a checkerboard instead\n");
+		game_state->texture_width  = 256;
+		game_state->texture_height = 256;
+		game_state->texture_pixels = create_checkerboard_texture(
+			&game_state->asset_arena, game_state->texture_width, game_state->texture_height
+		);
+	}
+
+	sim->square_world_position = (Vec3){ .x = 0.0f, .y = 0.0f, .z = 5.0f };
+	sim->square_scale = 75.0f;
+	sim->square_cull_mode = CULL_MODE_BACK;
+
+	sim->camera_world_position = (Vec3){0};
+	sim->camera_world_orientation = mat3x3_create_identity();
+
+	sim->render_wireframe = 0;
+
+	// Default to the widest raster kernel this machine supports.
+	sim->has_avx2 = cpu_supports_avx2();
+#ifdef RASTER_SIMD_X64
+	sim->raster_kernel = sim->has_avx2 ? RASTER_KERNEL_AVX2 : RASTER_KERNEL_SSE2;
+#else
+	sim->raster_kernel = RASTER_KERNEL_SCALAR;
+#endif
+
+	sim->depth_clear_policy = DEPTH_CLEAR_PER_BIN;
+	sim->hierarchical_z = true;
+	sim->guard_band_clipping = true;
+	sim->reverse_z = true;
+
+	// Each side starts out owning one slot and the third is in the mailbox, then the initial state
+	// gets published so that there's always a snapshot to render even before the first update.
+	storage->sim_snapshot_write_slot = 0;
+	game_state->sim_snapshot_read_slot = 1;
+	storage->snapshots.mailbox = 2;
+	publish_sim_snapshot(&storage->snapshots, &storage->sim_snapshot_write_slot, sim);
+}
+
+EXPORT void game_render(GameMemory *memory, GameOffscreenBuffer *offscreen_buffer, float interpolation_alpha) {
+	PROFILE_SET_GET_RING(memory->platform_get_profile_ring);
+	PROFILE_BIND_THREAD();
+	PROFILE_BEGIN("game_render");
+	GameStorage *storage = (GameStorage *)memory->storage;
+	GameState *game_state = &storage->render;
+	// NOTE(mal): Everything the simulation decided comes from this snapshot. It won't change under us
+	// for the rest of the frame even if update is running on another thread.
+	SimState *sim = acquire_sim_snapshot(&storage->snapshots, &game_state->sim_snapshot_read_slot);
+	MemoryArena *frame_arena = &game_state->frame_arena;
+	frame_arena->used = 0;
+	resize_render_targets(game_state, offscreen_buffer->width, offscreen_buffer->height);
+	if (sim->reverse_z != game_state->depth_buffer_reverse_z || sim->hierarchical_z != game_state->depth_buffer_hierarchical_z) {
+		// Either everything in the depth buffer is in the other convention now, or the tile depth
+		// ranges weren't maintained while hierarchical Z was off.
+		game_state->depth_buffer_invalid = true;
+		game_state->depth_buffer_reverse_z = sim->reverse_z;
+		game_state->depth_buffer_hierarchical_z = sim->hierarchical_z;
+	}
+	// NOTE(mal): The frame lands somewhere between two ticks, so anything that moves gets drawn where
+	// it was interpolation_alpha of the way from the previous tick to the latest one. This puts what's
+	// on screen up to a tick behind the simulation, in exchange for motion that doesn't stutter when
+	// the frame rate and the tick rate don't line up.
+	Vec3 camera_world_position = vec3_lerp(
+		sim->previous_camera_world_position, sim->camera_world_position, interpolation_alpha
+	);
+	Mat3x3 camera_world_orientation = sim->camera_world_orientation;
+	bool is_benchmark_scene = memory->benchmark_scene != GAME_BENCHMARK_SCENE_NONE;
+	if (is_benchmark_scene) {
+		// Wherever the camera was moved to, see BENCHMARK SCENES
+		camera_world_position = (Vec3){0};
+		camera_world_orientation = mat3x3_create_identity();
+	}
+	// Rotation wraps around at +-180, so interpolate across the shorter way around.
+	float rotation_delta_degrees = sim->rotation_y_degrees - sim->previous_rotation_y_degrees;
+	if (rotation_delta_degrees > 180.0f) rotation_delta_degrees -= 360.0f;
+	if (rotation_delta_degrees < -180.0f) rotation_delta_degrees += 360.0f;
+	float rotation_y_degrees = sim->previous_rotation_y_degrees + rotation_delta_degrees * interpolation_alpha;
+
+	ViewTransforms *view = &game_state->view;
+	update_view_transforms(
+		view,
+		camera_world_position, camera_world_orientation,
+		offscreen_buffer->width, offscreen_buffer->height
+	);
+
+	// NOTE(mal): The pixels don't get cleared here. Each bin's render job clears its own pixels
+	// right before rasterizing into them (see render_bin_work).
+	uint32_t *pixels = (uint32_t *)offscreen_buffer->memory;
+
+	RenderFrame *frame = push_struct(frame_arena, RenderFrame);
+	*frame = (RenderFrame){
+		.pixels         = pixels,
+		.width          = offscreen_buffer->width,
+		.height         = offscreen_buffer->height,
+		.texture_pixels = game_state->texture_pixels,
+		.texture_width  = game_state->texture_width,
+		.texture_height = game_state->texture_height,
+		.raster_kernel  = sim->raster_kernel,
+		.depth_buffer       = game_state->depth_buffer,
+		.depth_clear_policy = sim->depth_clear_policy,
+		.reverse_z          = sim->reverse_z,
+		.tile_depth_ranges  = sim->hierarchical_z ? game_state->tile_depth_ranges : NULL,
+		.tile_count_x       = game_state->tile_count_x,
+		.ndc_to_screen      = view->ndc_to_screen,
+		.near_plane         = CAMERA_NEAR_PLANE,
+		.guard_band_clipping = sim->guard_band_clipping,
+		.triangle_capacity  = MAX_FRAME_TRIANGLES,
+		.skip_rasterization = sim->skip_rasterization,
+		.raster_tile_grid   = sim->render_raster_tile_state,
+	};
+	frame->triangles = push_array(frame_arena, frame->triangle_capacity, RasterTriangle);
+	if (sim->visibility_buffer) {
+		frame->visibility_buffer = game_state->visibility_buffer;
+	}
+
+	//////////////////////////////
+	// GEOMETRY
+	//////////////////////////////
+	if (is_benchmark_scene) {
+		submit_benchmark_scene(frame, frame_arena, view, &game_state->benchmark_meshes, memory->benchmark_scene);
+	} else {
+		Square3D *square = &game_state->square;
+		square->world_position = sim->square_world_position;
+		square->scale = sim->square_scale;
+		game_state->square_mesh.cull_mode = sim->square_cull_mode;
+		Mat3x3 orientation = mat3x3_create_rotation_y(DEGREES_TO_RADIANS(rotation_y_degrees));
+		Mat4x4 *local_to_clip = compose_local_to_clip(
+			&square->transform_cache, view, square->world_position, orientation, square->scale
+		);
+		submit_mesh(frame, frame_arena, &game_state->square_mesh, local_to_clip);
+	}
+	if (sim->render_stress_mesh && !is_benchmark_scene) {
+		// Behind the square and big enough to fill the view
+		Vec3 position = { .z = 40.0f };
+		Mat4x4 *local_to_clip = compose_local_to_clip(
+			&game_state->stress_mesh_transform_cache, view, position, mat3x3_create_identity(), 40.0f
+		);
+		submit_mesh(frame, frame_arena, &game_state->stress_mesh, local_to_clip);
+	}
+
+	if (sim->watertight_test) {
+		setup_watertight_test_mesh(frame, frame_arena, game_state->watertight_test_seed++);
+	}
+
+	//////////////////////////////
+	// BINNING AND RASTERIZATION
+	//////////////////////////////
+	// Every bin is rasterized as its own job on the render queue. Since the bins are disjoint
+	// the workers never need to synchronize with each other, and since each bin's triangle list
+	// is in submission order the result is identical to rasterizing single threaded.
+	// NOTE(mal): Every bin gets a job, even the ones without any triangles (or with rasterization
+	// skipped entirely), since the jobs are also what clear the frame.
+	if (!frame->skip_rasterization) {
+		if (sim->depth_clear_policy == DEPTH_CLEAR_EVERY_FRAME || game_state->depth_buffer_invalid) {
+			PROFILE_BEGIN("clear");
+			clear_depth_rect(frame, 0, 0, frame->width, frame->height);
+			PROFILE_END("clear");
+			game_state->depth_buffer_invalid = false;
+		}
+	}
+	PROFILE_BEGIN("bin triangles");
+	bin_triangles(frame, frame_arena);
+	PROFILE_END("bin triangles");
+	frame->bin_pixel_hashes = game_state->bin_pixel_hashes;
+	frame->bin_damaged = push_array(frame_arena, frame->bin_count_x * frame->bin_count_y, uint8_t);
+	for (int bin_y = 0; bin_y < frame->bin_count_y; bin_y++) {
+		for (int bin_x = 0; bin_x < frame->bin_count_x; bin_x++) {
+			RenderBinJob *job = push_struct(frame_arena, RenderBinJob);
+			*job = (RenderBinJob){ .frame = frame, .bin_x = bin_x, .bin_y = bin_y };
+			memory->platform_add_work_queue_entry(memory->render_queue, render_bin_work, job);
+		}
+	}
+	memory->platform_complete_all_work(memory->render_queue);
+
+	if (frame->overdraw_counts && !frame->skip_rasterization) {
+		resolve_watertight_test(frame);
+	}
+
+	// NOTE(mal): Only shows the triangles that made it through culling.
+	// NOTE(mal): Drawn after rasterization so that the wireframe always ends up on top.
+	if (sim->render_wireframe) {
+		for (uint32_t t_i = 0; t_i < frame->triangle_count; t_i++) {
+			Vertex *vs = frame->triangles[t_i].vertices;
+			draw_line_2d(
+				pixels, offscreen_buffer->width, offscreen_buffer->height,
+				vs[0].position.x, vs[0].position.y, vs[1].position.x, vs[1].position.y
+			);
+			draw_line_2d(
+				pixels, offscreen_buffer->width, offscreen_buffer->height,
+				vs[1].position.x, vs[1].position.y, vs[2].position.x, vs[2].position.y
+			);
+			draw_line_2d(
+				pixels, offscreen_buffer->width, offscreen_buffer->height,
+				vs[2].position.x, vs[2].position.y, vs[0].position.x, vs[0].position.y
+			);
+		}
+	}
+
+	if (frame->raster_tile_grid == RENDER_RASTER_TILES_ONTOP) {
+		draw_raster_tile_grid(frame, 0, 0, frame->width, frame->height);
+	}
+
+	//////////////////////////////
+	// DAMAGE
+	//////////////////////////////
+	// NOTE(mal): Anything drawn on the main thread after the bin jobs isn't accounted for in the
+	// bins' hashes, so it damages the whole frame, this frame and the next (to erase it again).
+	bool is_drawn_over_bins =
+		frame->overdraw_counts || sim->render_wireframe || frame->raster_tile_grid == RENDER_RASTER_TILES_ONTOP;
+	if (is_drawn_over_bins || game_state->bin_pixel_hashes_invalid) {
+		memset(frame->bin_damaged, 1, frame->bin_count_x * frame->bin_count_y * sizeof(uint8_t));
+	}
+	game_state->bin_pixel_hashes_invalid = is_drawn_over_bins;
+	build_damage_rects(frame, offscreen_buffer);
+	PROFILE_END("game_render");
+}
+
+EXPORT void game_update(GameMemory *memory, GameInput *input, float dt) {
+	PROFILE_SET_GET_RING(memory->platform_get_profile_ring);
+	PROFILE_BIND_THREAD();
+	PROFILE_BEGIN("game_update");
+	GameStorage *storage = (GameStorage *)memory->storage;
+	SimState *sim = &storage->sim;
 
 	// TODO(mal): Local and world space (2D) have Y pointing up but screen space has Y pointing down.
 	// Need to include a transformation step that flips the direction of our Y axis!
 
-	game_state->camera_world_orientation = mat3x3_create_rotation_y(DEGREES_TO_RADIANS(0.0f));
-	game_state->square.scale = 10.0f;
-	game_state->square.world_position = (Vec3){ .z = game_state->square.scale * 2.0f };
+	sim->camera_world_orientation = mat3x3_create_rotation_y(DEGREES_TO_RADIANS(0.0f));
+	sim->square_scale = 10.0f;
+	sim->square_world_position = (Vec3){ .z = sim->square_scale * 2.0f };
+
+	sim->previous_rotation_y_degrees = sim->rotation_y_degrees;
+	sim->previous_camera_world_position = sim->camera_world_position;
 
 	// Rotate
-	const float rot_speed = 1.0f;
+	const float rot_speed = 60.0f; // degrees per second
 
-	if (input->keys[GAME_KEY_J].is_down) game_state->rotation_y_degrees += rot_speed;
-	if (input->keys[GAME_KEY_L].is_down) game_state->rotation_y_degrees -= rot_speed;
+	if (input->keys[GAME_KEY_J].is_down) sim->rotation_y_degrees += rot_speed * dt;
+	if (input->keys[GAME_KEY_L].is_down) sim->rotation_y_degrees -= rot_speed * dt;
 
-	if (game_state->rotation_y_degrees > 180.0f) game_state->rotation_y_degrees -= 360.0f;
-	if (game_state->rotation_y_degrees < -180.0f) game_state->rotation_y_degrees += 360.0f;
+	if (sim->rotation_y_degrees > 180.0f) sim->rotation_y_degrees -= 360.0f;
+	if (sim->rotation_y_degrees < -180.0f) sim->rotation_y_degrees += 360.0f;
 
-	const float move_speed = 1.0f;
+	const float move_speed = 60.0f; // units per second
 
-	if (input->keys[GAME_KEY_W].is_down) game_state->camera_world_position.z += move_speed;
-	if (input->keys[GAME_KEY_S].is_down) game_state->camera_world_position.z -= move_speed;
-	if (input->keys[GAME_KEY_A].is_down) game_state->camera_world_position.x -= move_speed;
-	if (input->keys[GAME_KEY_D].is_down) game_state->camera_world_position.x += move_speed;
+	if (input->keys[GAME_KEY_W].is_down) sim->camera_world_position.z += move_speed * dt;
+	if (input->keys[GAME_KEY_S].is_down) sim->camera_world_position.z -= move_speed * dt;
+	if (input->keys[GAME_KEY_A].is_down) sim->camera_world_position.x -= move_speed * dt;
+	if (input->keys[GAME_KEY_D].is_down) sim->camera_world_position.x += move_speed * dt;
 
 	#define PRESSED_THIS_FRAME(game_key) input->keys[(game_key)].is_down && !input->keys[(game_key)].was_down
 	if (PRESSED_THIS_FRAME(GAME_KEY_F1)) {
-		game_state->skip_rasterization = !game_state->skip_rasterization;
+		sim->skip_rasterization = !sim->skip_rasterization;
 	}
 	if (PRESSED_THIS_FRAME(GAME_KEY_F2)) {
-		game_state->render_wireframe = !game_state->render_wireframe;
+		sim->render_wireframe = !sim->render_wireframe;
 	}
 	if (PRESSED_THIS_FRAME(GAME_KEY_F3)) {
 		RenderRasterTileState next_state;
-		switch (game_state->render_raster_tile_state) {
+		switch (sim->render_raster_tile_state) {
 			case RENDER_RASTER_TILES_OFF:
 				next_state = RENDER_RASTER_TILES_BELOW;
 				break;
@@ -1195,6 +3596,62 @@ EXPORT void game_update(GameMemory *memory, GameInput *input) {
 				next_state = RENDER_RASTER_TILES_OFF;
 				break;
 		}
-		game_state->render_raster_tile_state = next_state;
+		sim->render_raster_tile_state = next_state;
 	}
+	if (PRESSED_THIS_FRAME(GAME_KEY_F4)) {
+		// Cycle through the raster kernels, skipping any this machine can't run.
+		RasterKernel next_kernel = sim->raster_kernel;
+		do {
+			next_kernel = (next_kernel + 1) % RASTER_KERNEL_COUNT;
+		} while (
+		#ifndef RASTER_SIMD_X64
+			next_kernel != RASTER_KERNEL_SCALAR ||
+		#endif
+			(next_kernel == RASTER_KERNEL_AVX2 && !sim->has_avx2)
+		);
+		sim->raster_kernel = next_kernel;
+		printf("Raster kernel: %s\n", raster_kernel_names[next_kernel]);
+	}
+	if (PRESSED_THIS_FRAME(GAME_KEY_F5)) {
+		sim->watertight_test = !sim->watertight_test;
+		if (sim->watertight_test) {
+			printf("Watertight test: ON (grey = covered once, blue = never covered, red = covered more than once)\n");
+		} else {
+			printf("Watertight test: OFF\n");
+		}
+	}
+	if (PRESSED_THIS_FRAME(GAME_KEY_F6)) {
+		sim->depth_clear_policy = (sim->depth_clear_policy + 1) % DEPTH_CLEAR_POLICY_COUNT;
+		printf("Depth clear: %s\n", depth_clear_policy_names[sim->depth_clear_policy]);
+	}
+	if (PRESSED_THIS_FRAME(GAME_KEY_F7)) {
+		sim->reverse_z = !sim->reverse_z;
+		printf("Reverse Z: %s\n", sim->reverse_z ? "ON" : "OFF");
+	}
+	if (PRESSED_THIS_FRAME(GAME_KEY_F8)) {
+		sim->hierarchical_z = !sim->hierarchical_z;
+		printf("Hierarchical Z: %s\n", sim->hierarchical_z ? "ON" : "OFF");
+	}
+	if (PRESSED_THIS_FRAME(GAME_KEY_F9)) {
+		sim->render_stress_mesh = !sim->render_stress_mesh;
+		printf(
+			"Stress mesh: %s (%d triangles)\n",
+			sim->render_stress_mesh ? "ON" : "OFF", STRESS_MESH_CELLS * STRESS_MESH_CELLS * 2
+		);
+	}
+	if (PRESSED_THIS_FRAME(GAME_KEY_F10)) {
+		sim->guard_band_clipping = !sim->guard_band_clipping;
+		printf("Guard band clipping: %s\n", sim->guard_band_clipping ? "ON" : "OFF");
+	}
+	if (PRESSED_THIS_FRAME(GAME_KEY_F11)) {
+		sim->square_cull_mode = (sim->square_cull_mode + 1) % CULL_MODE_COUNT;
+		printf("Square cull mode: %s\n", cull_mode_names[sim->square_cull_mode]);
+	}
+	if (PRESSED_THIS_FRAME(GAME_KEY_V)) {
+		sim->visibility_buffer = !sim->visibility_buffer;
+		printf("Visibility buffer: %s\n", sim->visibility_buffer ? "ON" : "OFF");
+	}
+
+	publish_sim_snapshot(&storage->snapshots, &storage->sim_snapshot_write_slot, sim);
+	PROFILE_END("game_update");
 }
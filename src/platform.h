@@ -15,6 +15,8 @@
 // TODO(mal): Instead of this, maybe make types b8, b16, b32, b64 etc.
 typedef enum { false, true } bool;
 
+#include "profile.h"
+
 // TODO(mal): Have some cross platform printing solution in case I want to get rid of the c
 // standard library? Might have to have separate assertion definitions for platform and game...
 // Could then add some sort of printing function to the GameMemory struct.
@@ -49,11 +51,25 @@ typedef enum { false, true } bool;
 	#define ASSERT_MSG_FMT(expr, msg_fmt, ...)
 #endif
 
+// In pixels, with (x, y) the top left corner
+typedef struct GameRect {
+    int x;
+    int y;
+    int width;
+    int height;
+} GameRect;
+
+#define GAME_MAX_DAMAGE_RECTS 64
+
 typedef struct GameOffscreenBuffer {
     void *memory;
     int width;
     int height;
     int bytes_per_pixel;
+    // Filled in by game_render: the parts of the buffer that changed since the previous frame it
+    // rendered. Only these have to be presented.
+    int damage_rect_count;
+    GameRect damage_rects[GAME_MAX_DAMAGE_RECTS];
 } GameOffscreenBuffer;
 
 // NOTE(mal): These codes are based on win32 virtual keycodes
@@ -175,6 +191,8 @@ typedef struct GameInput {
 // NOTE(mal): For real file loading functions we'd want something nonblocking
 // and to protect against data loss (note taken from Casey Muratori's "Handmade
 // Hero")
+// NOTE(mal): Platforms may return NULL if the file can't be read (the headless platform does, since
+// it runs on machines without our assets), so the game has to be ready for it.
 #define DEBUG_PLATFORM_READ_ENTIRE_FILE_PARAMS (char *file_path)
 char *debug_platform_read_entire_file DEBUG_PLATFORM_READ_ENTIRE_FILE_PARAMS;
 typedef char *(*DEBUG_PlatformReadEntireFileFunction) DEBUG_PLATFORM_READ_ENTIRE_FILE_PARAMS;
@@ -183,11 +201,59 @@ typedef char *(*DEBUG_PlatformReadEntireFileFunction) DEBUG_PLATFORM_READ_ENTIRE
 void debug_platform_free_entire_file DEBUG_PLATFORM_FREE_ENTIRE_FILE_PARAMS;
 typedef void (*DEBUG_PlatformFreeEntireFileFunction) DEBUG_PLATFORM_FREE_ENTIRE_FILE_PARAMS;
 
+// NOTE(mal): Multithreading. The platform layer owns the worker threads and the queue itself (the
+// game only ever sees an opaque pointer). The game enqueues entries and then calls
+// platform_complete_all_work, during which the calling thread also pulls entries off the queue
+// until everything that was enqueued has finished.
+// WARN(mal): Entries must only ever be added from a single thread (the one that calls
+// platform_complete_all_work).
+typedef struct PlatformWorkQueue PlatformWorkQueue;
+
+#define PLATFORM_WORK_QUEUE_CALLBACK_PARAMS (PlatformWorkQueue *queue, void *data)
+typedef void (*PlatformWorkQueueCallback) PLATFORM_WORK_QUEUE_CALLBACK_PARAMS;
+
+#define PLATFORM_ADD_WORK_QUEUE_ENTRY_PARAMS (PlatformWorkQueue *queue, PlatformWorkQueueCallback callback, void *data)
+void platform_add_work_queue_entry PLATFORM_ADD_WORK_QUEUE_ENTRY_PARAMS;
+typedef void (*PlatformAddWorkQueueEntryFunction) PLATFORM_ADD_WORK_QUEUE_ENTRY_PARAMS;
+
+#define PLATFORM_COMPLETE_ALL_WORK_PARAMS (PlatformWorkQueue *queue)
+void platform_complete_all_work PLATFORM_COMPLETE_ALL_WORK_PARAMS;
+typedef void (*PlatformCompleteAllWorkFunction) PLATFORM_COMPLETE_ALL_WORK_PARAMS;
+
+// Canned scenes the platform can have the game render instead of its own, for measuring the
+// renderer in isolation (see the headless platform's --bench). They're all framed for a 16:9
+// offscreen buffer.
+typedef enum GameBenchmarkScene {
+	GAME_BENCHMARK_SCENE_NONE,              // the actual game
+	GAME_BENCHMARK_SCENE_FULLSCREEN_QUAD,   // one textured quad covering the screen
+	GAME_BENCHMARK_SCENE_SMALL_TRIANGLES,   // ~10k triangles of a few dozen pixels each
+	GAME_BENCHMARK_SCENE_NEAR_CLIP,         // every triangle crosses the near plane
+	GAME_BENCHMARK_SCENE_OVERDRAW,          // full-screen quads stacked back to front
+	GAME_BENCHMARK_SCENE_TEXTURE_MAGNIFIED, // a small part of the texture over the whole screen
+	GAME_BENCHMARK_SCENE_TEXTURE_MINIFIED,  // many small quads, each showing the whole texture
+	GAME_BENCHMARK_SCENE_COUNT,
+} GameBenchmarkScene;
+
 typedef struct GameMemory {
 	DEBUG_PlatformReadEntireFileFunction debug_platform_read_entire_file;
 	DEBUG_PlatformFreeEntireFileFunction debug_platform_free_entire_file;
 
-	// TODO(mal): maybe we should split this up into persistent (across frame boundaries) and scratch storage?
+	// Queue serviced by the platform's worker threads, used by the renderer to rasterize
+	// disjoint regions of the offscreen buffer in parallel.
+	PlatformWorkQueue *render_queue;
+	PlatformAddWorkQueueEntryFunction platform_add_work_queue_entry;
+	PlatformCompleteAllWorkFunction   platform_complete_all_work;
+
+	// Read by game_render every frame, can be switched at any time.
+	GameBenchmarkScene benchmark_scene;
+
+	// NULL if the platform doesn't collect profiling zones, see profile.h
+	PlatformGetProfileRingFunction platform_get_profile_ring;
+
+	// NOTE(mal): The game splits this into a region owned by game_update, a region owned by
+	// game_render, and the snapshots through which update hands its state over to render (see
+	// GameStorage in game.c). That's what lets the platform call game_update and game_render from
+	// different threads, as long as each one is only ever called from one thread at a time.
     void *storage;
     size_t storage_size;
 } GameMemory;
@@ -206,11 +272,20 @@ typedef struct GameMemory {
 EXPORT void game_init GAME_INIT_PARAMS;
 typedef void (*GameInitFunction) GAME_INIT_PARAMS;
 
-#define GAME_RENDER_PARAMS (GameMemory *memory, GameOffscreenBuffer *offscreen_buffer)
+// interpolation_alpha: how far along, in [0, 1], the frame is from the second to last update to the
+// last one (see GAME_UPDATE_DT).
+#define GAME_RENDER_PARAMS (GameMemory *memory, GameOffscreenBuffer *offscreen_buffer, float interpolation_alpha)
 EXPORT void game_render GAME_RENDER_PARAMS;
 typedef void (*GameRenderFunction) GAME_RENDER_PARAMS;
 
-#define GAME_UPDATE_PARAMS (GameMemory *memory, GameInput *input)
+// NOTE(mal): The simulation always advances in fixed steps of dt = GAME_UPDATE_DT seconds, however
+// fast or slow frames are. The platform runs as many updates as real time has passed, but never more
+// than GAME_MAX_UPDATES_PER_FRAME in a row: if updates ever fall behind real time, catching up on
+// every missed one would only make us fall further behind, so past that the game slows down instead.
+#define GAME_UPDATE_HZ 60
+#define GAME_UPDATE_DT (1.0f / GAME_UPDATE_HZ)
+#define GAME_MAX_UPDATES_PER_FRAME 5
+#define GAME_UPDATE_PARAMS (GameMemory *memory, GameInput *input, float dt)
 EXPORT void game_update GAME_UPDATE_PARAMS;
 typedef void (*GameUpdateFunction) GAME_UPDATE_PARAMS;
 
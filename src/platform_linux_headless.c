@@ -0,0 +1,742 @@
+// Headless platform layer. Loads game.so and runs it against an offscreen buffer in plain memory, as
+// fast as it can, without a window or a compositor. For measuring the renderer on machines that
+// can't display anything.
+//
+// Usage: platform_linux_headless [--frames N] [--size WIDTHxHEIGHT] [--workers N] [--input SCRIPT]
+//                                 [--no-assets] [--capture FRAMES [--out DIR] [--golden DIR [--tolerance N]]]
+//                                 [--trace FILE]
+//        platform_linux_headless --bench [--frames N] [--workers N] [--trace FILE]
+//
+// Prints each frame's update and render times as CSV on stdout, followed by a summary. Anything the
+// game itself prints goes to stderr instead.
+//
+// With --bench, renders each of the game's benchmark scenes (see GameBenchmarkScene) at each of
+// benchmark_sizes instead, and prints one line of CSV per scene and size: render time min, median
+// and 99th percentile in ms, and output pixels per second at the median.
+//
+// The input script is a list of key events, one per line: <frame> <down|up|tap> <key>
+// where key is a letter, a digit, F1-F12, SPACE, ENTER or ESCAPE, and tap is down that frame and up
+// the next. Everything after a # is a comment. e.g. to turn on the stress mesh and then rotate:
+//     0 tap F9
+//     10 down J
+//     70 up J
+//
+// --capture takes a comma separated list of frame numbers and writes each of those frames to --out
+// as frame_NNNN.tga. With --golden, they're compared against the TGAs with the same names in that
+// directory instead: a frame fails when any channel of any pixel is off by more than --tolerance,
+// and then the frame and a heatmap of the differences (diff_NNNN.tga, red where it's over) are
+// written to --out for a look. Exits with 1 if any frame failed. --no-assets makes every asset load
+// fail, so that the game falls back to its built-in ones and the frames don't depend on local files.
+//
+// --trace writes the profiling zones of the last frames of the run to FILE as a Chrome trace, see
+// TRACE EXPORT in platform_linux_profile.c. Only in builds with PROFILING_ENABLED.
+
+#define _DEFAULT_SOURCE
+
+// custom game/engine stuff
+#include "platform.h"
+#include "tga.h"
+
+// linux/unix stuff
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <linux/limits.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+// c standard library stuff
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform_linux_profile.c"
+#include "platform_linux_work_queue.c"
+
+//////////////////////////////////////////////////
+// GAME AND NON-PLATFORM STUFF
+//////////////////////////////////////////////////
+
+typedef struct GameCode {
+	void *lib_handle;
+	GameInitFunction game_init;
+	GameRenderFunction game_render;
+	GameUpdateFunction game_update;
+} GameCode;
+
+// NOTE(mal): No hot reloading here, a run is over long before anyone rebuilds.
+GameCode load_game_code() {
+	GameCode game_code = {0};
+
+	game_code.lib_handle = dlopen("./game.so", RTLD_NOW);
+	ASSERT_MSG_FMT(game_code.lib_handle, "Failed to open game lib: %s\n", dlerror());
+
+	game_code.game_init   = dlsym(game_code.lib_handle, "game_init");
+	game_code.game_update = dlsym(game_code.lib_handle, "game_update");
+	game_code.game_render = dlsym(game_code.lib_handle, "game_render");
+
+	ASSERT(game_code.game_init);
+	ASSERT(game_code.game_update);
+	ASSERT(game_code.game_render);
+
+	return game_code;
+}
+
+// Unlike the other platforms this returns NULL when the file can't be read, build boxes don't have
+// our assets.
+char *debug_platform_read_entire_file(char *file_path) {
+	int fd = open(file_path, O_RDONLY);
+	if (fd == -1) {
+		return NULL;
+	}
+	struct stat file_stat;
+	int stat_result = fstat(fd, &file_stat);
+	ASSERT_MSG_FMT(
+		stat_result == 0,
+		"Failed to stat file %s: %s\n",
+		file_path, strerror(errno)
+	);
+	// NOTE(mal): MAP_PRIVATE gives us copy-on-write, the game is free to write to the data.
+	char *file_data = mmap(0, (size_t)file_stat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	return file_data;
+}
+
+char *debug_platform_read_no_file(char *file_path) {
+	return NULL;
+}
+
+void debug_platform_free_entire_file(char *file_data, size_t file_data_len) {
+	int result = munmap(file_data, file_data_len);
+	ASSERT_MSG_FMT(
+		result == 0,
+		"Failed to free file %s: %s\n",
+		file_data, strerror(errno)
+	);
+}
+
+double linux_get_time_ms() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &time);
+	return time.tv_sec * 1000.0 + time.tv_nsec / 1e6;
+}
+
+//////////////////////////////////////////////////
+// INPUT SCRIPT
+//////////////////////////////////////////////////
+
+typedef struct ScriptedKeyEvent {
+	int frame;
+	GameKey key;
+	char is_down;
+} ScriptedKeyEvent;
+
+#define MAX_SCRIPTED_KEY_EVENTS 1024
+typedef struct InputScript {
+	int event_count;
+	ScriptedKeyEvent events[MAX_SCRIPTED_KEY_EVENTS];
+} InputScript;
+
+// Returns -1 for names we don't know.
+int parse_game_key(char *name) {
+	if (strlen(name) == 1 && ((name[0] >= 'A' && name[0] <= 'Z') || (name[0] >= '0' && name[0] <= '9'))) {
+		// Same as their ASCII codes
+		return name[0];
+	}
+	if (name[0] == 'F') {
+		int function_key = atoi(name + 1);
+		if (function_key >= 1 && function_key <= 12) {
+			return GAME_KEY_F1 + function_key - 1;
+		}
+	}
+	if (strcmp(name, "SPACE") == 0)  return GAME_KEY_SPACE;
+	if (strcmp(name, "ENTER") == 0)  return GAME_KEY_ENTER;
+	if (strcmp(name, "ESCAPE") == 0) return GAME_KEY_ESCAPE;
+	return -1;
+}
+
+void add_scripted_key_event(InputScript *script, int frame, GameKey key, char is_down) {
+	ASSERT_MSG(script->event_count < MAX_SCRIPTED_KEY_EVENTS, "Too many events in the input script");
+	script->events[script->event_count++] = (ScriptedKeyEvent){ .frame = frame, .key = key, .is_down = is_down };
+}
+
+// Returns false (after saying why) if the script couldn't be loaded.
+bool load_input_script(InputScript *script, char *file_path) {
+	FILE *file = fopen(file_path, "r");
+	if (!file) {
+		fprintf(stderr, "Failed to open input script %s: %s\n", file_path, strerror(errno));
+		return false;
+	}
+
+	bool result = true;
+	char line[256];
+	int line_number = 0;
+	while (result && fgets(line, sizeof(line), file)) {
+		line_number++;
+		char *comment = strchr(line, '#');
+		if (comment) *comment = '\0';
+
+		int frame;
+		char action[16];
+		char key_name[16];
+		int field_count = sscanf(line, "%d %15s %15s", &frame, action, key_name);
+		if (field_count == EOF) {
+			continue; // blank line
+		}
+
+		int key = field_count == 3 ? parse_game_key(key_name) : -1;
+		if (key < 0 || frame < 0) {
+			result = false;
+		} else if (strcmp(action, "down") == 0) {
+			add_scripted_key_event(script, frame, key, 1);
+		} else if (strcmp(action, "up") == 0) {
+			add_scripted_key_event(script, frame, key, 0);
+		} else if (strcmp(action, "tap") == 0) {
+			add_scripted_key_event(script, frame, key, 1);
+			add_scripted_key_event(script, frame + 1, key, 0);
+		} else {
+			result = false;
+		}
+		if (!result) {
+			fprintf(stderr, "%s:%d: expected <frame> <down|up|tap> <key>\n", file_path, line_number);
+		}
+	}
+
+	fclose(file);
+	return result;
+}
+
+void apply_input_script(InputScript *script, int frame, GameInput *input) {
+	for (int i = 0; i < script->event_count; i++) {
+		ScriptedKeyEvent *event = &script->events[i];
+		if (event->frame == frame) {
+			input->keys[event->key].is_down = event->is_down;
+		}
+	}
+}
+
+//////////////////////////////////////////////////
+// FRAME CAPTURE
+//////////////////////////////////////////////////
+
+#define MAX_CAPTURE_FRAMES 64
+typedef struct CaptureFrames {
+	int count;
+	int frames[MAX_CAPTURE_FRAMES];
+} CaptureFrames;
+
+bool parse_capture_frames(CaptureFrames *capture, char *list) {
+	char *cursor = list;
+	while (*cursor) {
+		char *number_end;
+		long frame = strtol(cursor, &number_end, 10);
+		if (number_end == cursor || frame < 0 || capture->count == MAX_CAPTURE_FRAMES) {
+			return false;
+		}
+		capture->frames[capture->count++] = (int)frame;
+		cursor = number_end;
+		if (*cursor == ',') {
+			cursor++;
+		} else if (*cursor) {
+			return false;
+		}
+	}
+	return capture->count > 0;
+}
+
+bool is_capture_frame(CaptureFrames *capture, int frame) {
+	for (int i = 0; i < capture->count; i++) {
+		if (capture->frames[i] == frame) return true;
+	}
+	return false;
+}
+
+// Writes 0x00RRGGBB pixels, top row first, as an opaque 32 bit TGA. Returns false (after saying why)
+// if the file couldn't be written.
+bool write_tga(int dir_fd, char *file_name, uint32_t *pixels, int width, int height) {
+	int fd = openat(dir_fd, file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		fprintf(stderr, "Failed to create %s: %s\n", file_name, strerror(errno));
+		return false;
+	}
+	TGA_Header header = {
+		.datatypecode    = TGA_DATATYPE_RGB,
+		.width           = (short)width,
+		.height          = (short)height,
+		.bitsperpixel    = 32,
+		// 8 bits of alpha
+		.imagedescriptor = TGA_DESCRIPTOR_TOP_LEFT_ORIGIN | 8,
+	};
+	size_t pixels_size = (size_t)width * height * sizeof(uint32_t);
+	uint32_t *opaque_pixels = malloc(pixels_size);
+	ASSERT(opaque_pixels);
+	for (size_t i = 0; i < (size_t)width * height; i++) {
+		opaque_pixels[i] = pixels[i] | 0xFF000000;
+	}
+	bool result = write(fd, &header, sizeof(header)) == sizeof(header)
+		&& write(fd, opaque_pixels, pixels_size) == (ssize_t)pixels_size;
+	if (!result) {
+		fprintf(stderr, "Failed to write %s: %s\n", file_name, strerror(errno));
+	}
+	free(opaque_pixels);
+	close(fd);
+	return result;
+}
+
+// Only reads the kind of TGA that write_tga writes, but from either origin. Returns the pixels top
+// row first (free them when done) or NULL (after saying why) if the file couldn't be read.
+uint32_t *read_tga(int dir_fd, char *file_name, int *width, int *height) {
+	FILE *file = NULL;
+	int fd = openat(dir_fd, file_name, O_RDONLY);
+	if (fd != -1) {
+		file = fdopen(fd, "rb");
+	}
+	if (!file) {
+		fprintf(stderr, "Failed to open %s: %s\n", file_name, strerror(errno));
+		return NULL;
+	}
+
+	uint32_t *pixels = NULL;
+	TGA_Header header;
+	if (fread(&header, sizeof(header), 1, file) == 1
+		&& header.datatypecode == TGA_DATATYPE_RGB && header.bitsperpixel == 32
+		&& header.colourmaptype == 0 && header.width > 0 && header.height > 0
+		&& fseek(file, header.idlength, SEEK_CUR) == 0) {
+		*width  = header.width;
+		*height = header.height;
+		pixels = malloc((size_t)*width * *height * sizeof(uint32_t));
+		ASSERT(pixels);
+		bool is_top_left_origin = header.imagedescriptor & TGA_DESCRIPTOR_TOP_LEFT_ORIGIN;
+		for (int row = 0; row < *height && pixels; row++) {
+			int y = is_top_left_origin ? row : *height - 1 - row;
+			if (fread(pixels + (size_t)y * *width, sizeof(uint32_t), *width, file) != (size_t)*width) {
+				free(pixels);
+				pixels = NULL;
+			}
+		}
+	}
+	if (!pixels) {
+		fprintf(stderr, "%s is not an uncompressed 32 bit TGA\n", file_name);
+	}
+	fclose(file);
+	return pixels;
+}
+
+typedef struct FrameComparison {
+	int failed_pixel_count;
+	int max_difference;
+} FrameComparison;
+
+// Fills in heatmap: within tolerance is the golden darkened to grey, over it is red, brighter the
+// further off it is.
+FrameComparison compare_frame(uint32_t *pixels, uint32_t *golden_pixels, uint32_t *heatmap, int pixel_count, int tolerance) {
+	FrameComparison comparison = {0};
+	for (int i = 0; i < pixel_count; i++) {
+		int difference = 0;
+		int golden_sum = 0;
+		for (int shift = 0; shift < 24; shift += 8) {
+			int channel        = (pixels[i] >> shift) & 0xFF;
+			int golden_channel = (golden_pixels[i] >> shift) & 0xFF;
+			int channel_difference = abs(channel - golden_channel);
+			if (channel_difference > difference) difference = channel_difference;
+			golden_sum += golden_channel;
+		}
+		if (difference > comparison.max_difference) comparison.max_difference = difference;
+		if (difference > tolerance) {
+			comparison.failed_pixel_count++;
+			uint32_t red = 0x80 + difference / 2;
+			heatmap[i] = red << 16;
+		} else {
+			uint32_t grey = golden_sum / 3 / 4;
+			heatmap[i] = (grey << 16) | (grey << 8) | grey;
+		}
+	}
+	return comparison;
+}
+
+typedef struct FrameCapture {
+	CaptureFrames frames;
+	int out_dir_fd;
+	int golden_dir_fd; // -1 when we're only capturing
+	int tolerance;
+	int failed_frame_count;
+} FrameCapture;
+
+void capture_frame(FrameCapture *capture, FILE *report, int frame, GameOffscreenBuffer *buffer) {
+	char file_name[32];
+	snprintf(file_name, sizeof(file_name), "frame_%04d.tga", frame);
+	uint32_t *pixels = buffer->memory;
+	if (capture->golden_dir_fd == -1) {
+		if (!write_tga(capture->out_dir_fd, file_name, pixels, buffer->width, buffer->height)) {
+			capture->failed_frame_count++;
+		}
+		return;
+	}
+
+	int golden_width;
+	int golden_height;
+	uint32_t *golden_pixels = read_tga(capture->golden_dir_fd, file_name, &golden_width, &golden_height);
+	if (!golden_pixels || golden_width != buffer->width || golden_height != buffer->height) {
+		fprintf(report, "# frame %d: FAIL, no %dx%d golden\n", frame, buffer->width, buffer->height);
+		capture->failed_frame_count++;
+		write_tga(capture->out_dir_fd, file_name, pixels, buffer->width, buffer->height);
+		free(golden_pixels);
+		return;
+	}
+
+	int pixel_count = buffer->width * buffer->height;
+	uint32_t *heatmap = malloc(pixel_count * sizeof(uint32_t));
+	ASSERT(heatmap);
+	FrameComparison comparison = compare_frame(pixels, golden_pixels, heatmap, pixel_count, capture->tolerance);
+	if (comparison.failed_pixel_count) {
+		char diff_file_name[32];
+		snprintf(diff_file_name, sizeof(diff_file_name), "diff_%04d.tga", frame);
+		fprintf(
+			report, "# frame %d: FAIL, %d pixels off by more than %d (max %d), see %s\n",
+			frame, comparison.failed_pixel_count, capture->tolerance, comparison.max_difference, diff_file_name
+		);
+		capture->failed_frame_count++;
+		write_tga(capture->out_dir_fd, file_name, pixels, buffer->width, buffer->height);
+		write_tga(capture->out_dir_fd, diff_file_name, heatmap, buffer->width, buffer->height);
+	} else {
+		fprintf(report, "# frame %d: ok (max difference %d)\n", frame, comparison.max_difference);
+	}
+	free(heatmap);
+	free(golden_pixels);
+}
+
+//////////////////////////////////////////////////
+// MAIN
+//////////////////////////////////////////////////
+
+// Writes out and closes the trace, if there's one.
+void write_trace(FILE *trace_file) {
+#ifdef PROFILING_ENABLED
+	if (trace_file) {
+		linux_write_profile_trace(trace_file, PROFILE_TRACE_FRAME_COUNT);
+		fclose(trace_file);
+	}
+#endif
+}
+
+typedef struct FrameTimeStats {
+	double min_ms;
+	double max_ms;
+	double total_ms;
+} FrameTimeStats;
+
+void add_frame_time(FrameTimeStats *stats, double ms) {
+	if (stats->total_ms == 0.0 || ms < stats->min_ms) stats->min_ms = ms;
+	if (ms > stats->max_ms) stats->max_ms = ms;
+	stats->total_ms += ms;
+}
+
+void print_frame_time_stats(FILE *report, char *name, FrameTimeStats *stats, int frame_count) {
+	fprintf(
+		report,
+		"# %s ms: min %.3f, avg %.3f, max %.3f\n",
+		name, stats->min_ms, stats->total_ms / frame_count, stats->max_ms
+	);
+}
+
+void print_usage(char *exe_name) {
+	fprintf(
+		stderr,
+		"Usage: %s [--frames N] [--size WIDTHxHEIGHT] [--workers N] [--input SCRIPT]\n"
+		"       %*s [--no-assets] [--capture FRAMES [--out DIR] [--golden DIR [--tolerance N]]]\n"
+		"       %*s [--trace FILE]\n"
+		"       %s --bench [--frames N] [--workers N] [--trace FILE]\n",
+		exe_name, (int)strlen(exe_name), "", (int)strlen(exe_name), "", exe_name
+	);
+}
+
+//////////////////////////////////////////////////
+// BENCHMARKS
+//////////////////////////////////////////////////
+
+const char *benchmark_scene_names[GAME_BENCHMARK_SCENE_COUNT] = {
+	[GAME_BENCHMARK_SCENE_NONE]              = "none",
+	[GAME_BENCHMARK_SCENE_FULLSCREEN_QUAD]   = "fullscreen_quad",
+	[GAME_BENCHMARK_SCENE_SMALL_TRIANGLES]   = "small_triangles",
+	[GAME_BENCHMARK_SCENE_NEAR_CLIP]         = "near_clip",
+	[GAME_BENCHMARK_SCENE_OVERDRAW]          = "overdraw",
+	[GAME_BENCHMARK_SCENE_TEXTURE_MAGNIFIED] = "texture_magnified",
+	[GAME_BENCHMARK_SCENE_TEXTURE_MINIFIED]  = "texture_minified",
+};
+
+// All 16:9, which is what the scenes are framed for.
+typedef struct BenchmarkSize {
+	int width;
+	int height;
+} BenchmarkSize;
+
+const BenchmarkSize benchmark_sizes[] = {
+	{ 640,  360  },
+	{ 1280, 720  },
+	{ 1920, 1080 },
+};
+#define BENCHMARK_SIZE_COUNT (sizeof(benchmark_sizes) / sizeof(benchmark_sizes[0]))
+#define BENCHMARK_MAX_WIDTH  1920
+#define BENCHMARK_MAX_HEIGHT 1080
+
+// Rendered (and thrown away) before measuring each scene, so that the caches, the render targets
+// and the damage hashes have settled.
+#define BENCHMARK_WARMUP_FRAMES 10
+
+int compare_doubles(const void *a, const void *b) {
+	double difference = *(const double *)a - *(const double *)b;
+	return (difference > 0.0) - (difference < 0.0);
+}
+
+void run_benchmarks(FILE *report, GameCode *game_code, GameMemory *game_memory, void *buffer_memory, int frame_count) {
+	double *render_ms = malloc(frame_count * sizeof(double));
+	ASSERT(render_ms);
+	fprintf(report, "scene,width,height,frames,min_ms,median_ms,p99_ms,pixels_per_second\n");
+	for (size_t size_index = 0; size_index < BENCHMARK_SIZE_COUNT; size_index++) {
+		BenchmarkSize size = benchmark_sizes[size_index];
+		ASSERT(size.width <= BENCHMARK_MAX_WIDTH && size.height <= BENCHMARK_MAX_HEIGHT);
+		GameOffscreenBuffer buffer = {
+			.memory          = buffer_memory,
+			.width           = size.width,
+			.height          = size.height,
+			.bytes_per_pixel = 4,
+		};
+		for (int scene = GAME_BENCHMARK_SCENE_NONE + 1; scene < GAME_BENCHMARK_SCENE_COUNT; scene++) {
+			game_memory->benchmark_scene = scene;
+			for (int frame = 0; frame < BENCHMARK_WARMUP_FRAMES; frame++) {
+				game_code->game_render(game_memory, &buffer, 1.0f);
+			}
+			for (int frame = 0; frame < frame_count; frame++) {
+				PROFILE_FRAME_MARKER();
+				double render_start_ms = linux_get_time_ms();
+				game_code->game_render(game_memory, &buffer, 1.0f);
+				render_ms[frame] = linux_get_time_ms() - render_start_ms;
+			}
+
+			qsort(render_ms, frame_count, sizeof(double), compare_doubles);
+			double min_ms    = render_ms[0];
+			double median_ms = render_ms[frame_count / 2];
+			// Nearest rank
+			int p99_rank = (frame_count * 99 + 99) / 100;
+			double p99_ms    = render_ms[p99_rank - 1];
+			double pixels_per_second = (double)size.width * size.height / (median_ms / 1000.0);
+			fprintf(
+				report, "%s,%d,%d,%d,%.3f,%.3f,%.3f,%.0f\n",
+				benchmark_scene_names[scene], size.width, size.height, frame_count,
+				min_ms, median_ms, p99_ms, pixels_per_second
+			);
+			fflush(report);
+		}
+	}
+	game_memory->benchmark_scene = GAME_BENCHMARK_SCENE_NONE;
+	free(render_ms);
+}
+
+int main(int argc, char **argv) {
+	int frame_count   = 0; // default depends on the mode
+	bool run_benchmark_scenes = false;
+	int buffer_width  = 800;
+	int buffer_height = 600;
+	long core_count = sysconf(_SC_NPROCESSORS_ONLN);
+	// NOTE(mal): The main thread also works the queue while it waits in platform_complete_all_work,
+	// so by default we only spawn one worker per additional core.
+	int render_worker_count = core_count > 1 ? (int)core_count - 1 : 0;
+	char *input_script_path = NULL;
+	bool load_assets = true;
+	FrameCapture capture = { .tolerance = 0 };
+	char *capture_out_dir_path = ".";
+	char *capture_golden_dir_path = NULL;
+	char *trace_path = NULL;
+	for (int i = 1; i < argc; i++) {
+		bool has_value = i + 1 < argc;
+		if (strcmp(argv[i], "--frames") == 0 && has_value) {
+			frame_count = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--size") == 0 && has_value) {
+			if (sscanf(argv[++i], "%dx%d", &buffer_width, &buffer_height) != 2) {
+				print_usage(argv[0]);
+				return 2;
+			}
+		} else if (strcmp(argv[i], "--workers") == 0 && has_value) {
+			render_worker_count = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--input") == 0 && has_value) {
+			input_script_path = argv[++i];
+		} else if (strcmp(argv[i], "--no-assets") == 0) {
+			load_assets = false;
+		} else if (strcmp(argv[i], "--capture") == 0 && has_value) {
+			if (!parse_capture_frames(&capture.frames, argv[++i])) {
+				print_usage(argv[0]);
+				return 2;
+			}
+		} else if (strcmp(argv[i], "--out") == 0 && has_value) {
+			capture_out_dir_path = argv[++i];
+		} else if (strcmp(argv[i], "--golden") == 0 && has_value) {
+			capture_golden_dir_path = argv[++i];
+		} else if (strcmp(argv[i], "--tolerance") == 0 && has_value) {
+			capture.tolerance = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--trace") == 0 && has_value) {
+			trace_path = argv[++i];
+		} else if (strcmp(argv[i], "--bench") == 0) {
+			run_benchmark_scenes = true;
+		} else {
+			print_usage(argv[0]);
+			return 2;
+		}
+	}
+	if (frame_count == 0) {
+		frame_count = run_benchmark_scenes ? 100 : 600;
+	}
+	if (run_benchmark_scenes) {
+		buffer_width  = BENCHMARK_MAX_WIDTH;
+		buffer_height = BENCHMARK_MAX_HEIGHT;
+	}
+	if (frame_count <= 0 || buffer_width <= 0 || buffer_height <= 0 || render_worker_count < 0
+		|| capture.tolerance < 0 || (capture_golden_dir_path && capture.frames.count == 0)) {
+		print_usage(argv[0]);
+		return 2;
+	}
+
+	// NOTE(mal): Before we chdir, the script's and the capture directories' paths are relative to
+	// where we were started from. Hang on to the directories themselves, not their paths.
+	static InputScript input_script;
+	if (input_script_path && !load_input_script(&input_script, input_script_path)) {
+		return 1;
+	}
+#ifndef PROFILING_ENABLED
+	if (trace_path) {
+		fprintf(stderr, "--trace needs a build with PROFILING_ENABLED\n");
+		return 2;
+	}
+#endif
+	FILE *trace_file = NULL;
+	if (trace_path) {
+		trace_file = fopen(trace_path, "w");
+		if (!trace_file) {
+			fprintf(stderr, "Failed to create %s: %s\n", trace_path, strerror(errno));
+			return 1;
+		}
+	}
+	capture.out_dir_fd    = -1;
+	capture.golden_dir_fd = -1;
+	if (capture.frames.count > 0) {
+		mkdir(capture_out_dir_path, 0755);
+		capture.out_dir_fd = open(capture_out_dir_path, O_RDONLY | O_DIRECTORY);
+		if (capture.out_dir_fd == -1) {
+			fprintf(stderr, "Failed to open %s: %s\n", capture_out_dir_path, strerror(errno));
+			return 1;
+		}
+	}
+	if (capture_golden_dir_path) {
+		capture.golden_dir_fd = open(capture_golden_dir_path, O_RDONLY | O_DIRECTORY);
+		if (capture.golden_dir_fd == -1) {
+			fprintf(stderr, "Failed to open %s: %s\n", capture_golden_dir_path, strerror(errno));
+			return 1;
+		}
+	}
+
+	// Same as the other platforms: game.so and the assets are found relative to the executable.
+	char exe_path[PATH_MAX];
+	ssize_t exe_path_len = readlink("/proc/self/exe", exe_path, sizeof(exe_path) - 1);
+	ASSERT_MSG(exe_path_len > 0, "Failed to get path of executable");
+	exe_path[exe_path_len] = '\0';
+	char *exe_dir_end = strrchr(exe_path, '/');
+	*exe_dir_end = '\0';
+	int chdir_result = chdir(exe_path);
+	ASSERT(chdir_result == 0);
+
+	// NOTE(mal): The game printfs whenever something gets toggled. Point stdout at stderr so that
+	// our report is the only thing left on the real stdout.
+	fflush(stdout);
+	FILE *report = fdopen(dup(STDOUT_FILENO), "w");
+	ASSERT(report);
+	dup2(STDERR_FILENO, STDOUT_FILENO);
+
+	GameCode game_code = load_game_code();
+
+	GameMemory game_memory = {0};
+	game_memory.debug_platform_read_entire_file = load_assets ? debug_platform_read_entire_file : debug_platform_read_no_file;
+	game_memory.debug_platform_free_entire_file = debug_platform_free_entire_file;
+	game_memory.storage_size = 192ul * 1024ul * 1024ul;
+	game_memory.storage = mmap(NULL, game_memory.storage_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	ASSERT(game_memory.storage != MAP_FAILED);
+#ifdef PROFILING_ENABLED
+	game_memory.platform_get_profile_ring = platform_get_profile_ring;
+#endif
+	PROFILE_SET_GET_RING(platform_get_profile_ring);
+	linux_start_profiling();
+
+	static PlatformWorkQueue render_queue;
+	linux_make_work_queue(&render_queue, render_worker_count);
+	game_memory.render_queue = &render_queue;
+	game_memory.platform_add_work_queue_entry = platform_add_work_queue_entry;
+	game_memory.platform_complete_all_work    = platform_complete_all_work;
+
+	GameOffscreenBuffer game_offscreen_buffer = {0};
+	game_offscreen_buffer.width           = buffer_width;
+	game_offscreen_buffer.height          = buffer_height;
+	game_offscreen_buffer.bytes_per_pixel = 4;
+	size_t buffer_size = (size_t)buffer_width * buffer_height * game_offscreen_buffer.bytes_per_pixel;
+	game_offscreen_buffer.memory = mmap(NULL, buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	ASSERT(game_offscreen_buffer.memory != MAP_FAILED);
+
+	game_code.game_init(&game_memory, buffer_width, buffer_height);
+
+	if (run_benchmark_scenes) {
+		fprintf(report, "# %d render workers\n", render_worker_count);
+		run_benchmarks(report, &game_code, &game_memory, game_offscreen_buffer.memory, frame_count);
+		fclose(report);
+		write_trace(trace_file);
+		return 0;
+	}
+
+	// NOTE(mal): Exactly one update per frame and every frame rendered right on a tick, so that a run
+	// is the same every time no matter how long its frames take.
+	GameInput game_input = {0};
+	FrameTimeStats update_stats = {0};
+	FrameTimeStats render_stats = {0};
+	fprintf(report, "frame,update_ms,render_ms\n");
+	for (int frame = 0; frame < frame_count; frame++) {
+		PROFILE_FRAME_MARKER();
+		apply_input_script(&input_script, frame, &game_input);
+
+		double update_start_ms = linux_get_time_ms();
+		game_code.game_update(&game_memory, &game_input, GAME_UPDATE_DT);
+		double update_end_ms = linux_get_time_ms();
+
+		for (int i = 0; i < NUM_GAME_KEYS; i++) {
+			game_input.keys[i].was_down = game_input.keys[i].is_down;
+		}
+
+		double render_start_ms = linux_get_time_ms();
+		game_code.game_render(&game_memory, &game_offscreen_buffer, 1.0f);
+		double render_end_ms = linux_get_time_ms();
+
+		double update_ms = update_end_ms - update_start_ms;
+		double render_ms = render_end_ms - render_start_ms;
+		add_frame_time(&update_stats, update_ms);
+		add_frame_time(&render_stats, render_ms);
+		fprintf(report, "%d,%.3f,%.3f\n", frame, update_ms, render_ms);
+
+		if (is_capture_frame(&capture.frames, frame)) {
+			capture_frame(&capture, report, frame, &game_offscreen_buffer);
+		}
+	}
+
+	fprintf(
+		report, "# %d frames at %dx%d with %d render workers\n",
+		frame_count, buffer_width, buffer_height, render_worker_count
+	);
+	print_frame_time_stats(report, "update", &update_stats, frame_count);
+	print_frame_time_stats(report, "render", &render_stats, frame_count);
+	if (capture.failed_frame_count) {
+		fprintf(report, "# %d of %d captured frames failed\n", capture.failed_frame_count, capture.frames.count);
+	}
+	fclose(report);
+	write_trace(trace_file);
+
+	return capture.failed_frame_count ? 1 : 0;
+}
@@ -0,0 +1,204 @@
+// NOTE(mal): Shared by the Linux platform layers, which #include this file directly rather than
+// building it on its own. Expects platform.h, time.h, stdio.h and stdlib.h to already be included.
+
+//////////////////////////////////////////////////
+// PROFILING
+//////////////////////////////////////////////////
+// NOTE(mal): The rings that profile.h's zones get recorded into, one per thread that has recorded
+// anything, handed out in the order threads first ask for one. Threads past PROFILE_MAX_THREADS
+// just don't get profiled.
+#ifdef PROFILING_ENABLED
+
+#define PROFILE_MAX_THREADS 32
+typedef struct ProfileRings {
+	// Can overshoot PROFILE_MAX_THREADS, see linux_get_profile_ring_count
+	volatile uint32_t count;
+	ProfileRing rings[PROFILE_MAX_THREADS];
+} ProfileRings;
+
+static ProfileRings profile_rings;
+static PROFILE_THREAD_LOCAL ProfileRing *linux_thread_profile_ring;
+
+ProfileRing *platform_get_profile_ring(void) {
+	if (!linux_thread_profile_ring) {
+		uint32_t thread_index = __atomic_fetch_add(&profile_rings.count, 1, __ATOMIC_ACQ_REL);
+		if (thread_index >= PROFILE_MAX_THREADS) {
+			return NULL;
+		}
+		linux_thread_profile_ring = &profile_rings.rings[thread_index];
+		linux_thread_profile_ring->thread_index = thread_index;
+	}
+	return linux_thread_profile_ring;
+}
+
+uint32_t linux_get_profile_ring_count() {
+	uint32_t count = __atomic_load_n(&profile_rings.count, __ATOMIC_ACQUIRE);
+	return count < PROFILE_MAX_THREADS ? count : PROFILE_MAX_THREADS;
+}
+
+// Binds the calling thread to its ring (see PROFILE_BIND_THREAD), under the name it shows up as in
+// traces. Every thread the platform starts calls this first thing.
+void linux_bind_profile_thread(const char *name) {
+	PROFILE_BIND_THREAD();
+	ProfileRing *ring = platform_get_profile_ring();
+	if (ring) {
+		ring->thread_name = name;
+	}
+}
+
+//////////////////////////////////////////////////
+// TRACE EXPORT
+//////////////////////////////////////////////////
+// NOTE(mal): Writes the rings out in Chrome's Trace Event Format, which Perfetto (ui.perfetto.dev)
+// and chrome://tracing open directly. Each zone becomes a complete ("X") event on its thread's track
+// and each frame marker a global instant event, i.e. a line across every track.
+// See https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+
+// Frames per trace, a couple of seconds' worth
+#define PROFILE_TRACE_FRAME_COUNT 120
+// NOTE(mal): Other threads keep recording while we export, so the oldest events in a full ring can
+// get overwritten while we read them. Staying this far away from the oldest ones makes that a
+// non-issue unless a thread records this many events in the time it takes to export.
+#define PROFILE_TRACE_RING_MARGIN 4096
+#define PROFILE_TRACE_MAX_DEPTH 64
+
+// NOTE(mal): rdtsc ticks at a constant rate on anything from the last decade, but we don't know
+// what that rate is. We measure it against CLOCK_MONOTONIC from linux_start_profiling to whenever
+// we export.
+typedef struct ProfileClockSample {
+	uint64_t timestamp;
+	uint64_t ns;
+} ProfileClockSample;
+
+static ProfileClockSample profile_clock_start;
+
+ProfileClockSample linux_sample_profile_clock() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (ProfileClockSample){
+		.timestamp = __rdtsc(),
+		.ns        = (uint64_t)time.tv_sec * 1000000000ull + (uint64_t)time.tv_nsec,
+	};
+}
+
+// Call once at startup, from the main thread, after PROFILE_SET_GET_RING and before anything gets
+// profiled.
+void linux_start_profiling() {
+	profile_clock_start = linux_sample_profile_clock();
+	linux_bind_profile_thread("main");
+}
+
+int compare_timestamps_descending(const void *a, const void *b) {
+	uint64_t timestamp_a = *(const uint64_t *)a;
+	uint64_t timestamp_b = *(const uint64_t *)b;
+	return (timestamp_a < timestamp_b) - (timestamp_a > timestamp_b);
+}
+
+// Everything in rings[ring_index] that's safe to read: [*first, *end)
+void get_readable_profile_events(uint32_t ring_index, uint64_t *first, uint64_t *end) {
+	ProfileRing *ring = &profile_rings.rings[ring_index];
+	*end = __atomic_load_n(&ring->write_index, __ATOMIC_ACQUIRE);
+	uint64_t readable_count = PROFILE_RING_EVENT_COUNT - PROFILE_TRACE_RING_MARGIN;
+	*first = *end > readable_count ? *end - readable_count : 0;
+}
+
+// The timestamp of the frame_count'th most recent frame marker (on any thread), or 0 if there
+// haven't been that many.
+uint64_t find_profile_trace_start(int frame_count) {
+	size_t marker_count = 0;
+	size_t marker_capacity = 256;
+	uint64_t *markers = malloc(marker_capacity * sizeof(uint64_t));
+	ASSERT(markers);
+	uint32_t ring_count = linux_get_profile_ring_count();
+	for (uint32_t r = 0; r < ring_count; r++) {
+		uint64_t first, end;
+		get_readable_profile_events(r, &first, &end);
+		for (uint64_t i = first; i < end; i++) {
+			ProfileEvent *event = &profile_rings.rings[r].events[i % PROFILE_RING_EVENT_COUNT];
+			if (event->type != PROFILE_EVENT_FRAME) continue;
+			if (marker_count == marker_capacity) {
+				marker_capacity *= 2;
+				markers = realloc(markers, marker_capacity * sizeof(uint64_t));
+				ASSERT(markers);
+			}
+			markers[marker_count++] = event->timestamp;
+		}
+	}
+
+	uint64_t result = 0;
+	if (marker_count >= (size_t)frame_count) {
+		qsort(markers, marker_count, sizeof(uint64_t), compare_timestamps_descending);
+		result = markers[frame_count - 1];
+	}
+	free(markers);
+	return result;
+}
+
+// Writes (roughly) the last frame_count frames of every thread's zones to file as a trace. Zones
+// that were still open when the export started, or that began before the first of those frames,
+// are left out.
+// NOTE(mal): Zone names go into the JSON as is, so they mustn't have quotes or backslashes in them.
+void linux_write_profile_trace(FILE *file, int frame_count) {
+	ProfileClockSample clock_end = linux_sample_profile_clock();
+	double ticks_per_us = clock_end.ns > profile_clock_start.ns
+		? (double)(clock_end.timestamp - profile_clock_start.timestamp) / ((clock_end.ns - profile_clock_start.ns) / 1000.0)
+		: 1.0;
+	uint64_t trace_start = find_profile_trace_start(frame_count);
+	if (trace_start < profile_clock_start.timestamp) {
+		trace_start = profile_clock_start.timestamp;
+	}
+
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"game\"}}");
+	uint32_t ring_count = linux_get_profile_ring_count();
+	for (uint32_t r = 0; r < ring_count; r++) {
+		ProfileRing *ring = &profile_rings.rings[r];
+		fprintf(
+			file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+			ring->thread_index, ring->thread_name ? ring->thread_name : "unnamed"
+		);
+		// Keeps the tracks in the order the threads first recorded anything, main thread on top.
+		fprintf(
+			file, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"sort_index\":%u}}",
+			ring->thread_index, ring->thread_index
+		);
+
+		uint64_t first, end;
+		get_readable_profile_events(r, &first, &end);
+		ProfileEvent *open_zones[PROFILE_TRACE_MAX_DEPTH];
+		int depth = 0;
+		for (uint64_t i = first; i < end; i++) {
+			ProfileEvent *event = &ring->events[i % PROFILE_RING_EVENT_COUNT];
+			if (event->type == PROFILE_EVENT_BEGIN) {
+				if (depth < PROFILE_TRACE_MAX_DEPTH) {
+					open_zones[depth] = event;
+				}
+				depth++;
+			} else if (event->type == PROFILE_EVENT_END) {
+				// The first events we can read may be the ends of zones whose beginnings are gone.
+				if (depth == 0) continue;
+				depth--;
+				if (depth >= PROFILE_TRACE_MAX_DEPTH) continue;
+				ProfileEvent *begin = open_zones[depth];
+				if (begin->timestamp < trace_start) continue;
+				fprintf(
+					file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+					begin->name, ring->thread_index,
+					(begin->timestamp - trace_start) / ticks_per_us,
+					(event->timestamp - begin->timestamp) / ticks_per_us
+				);
+			} else if (event->type == PROFILE_EVENT_FRAME && event->timestamp >= trace_start) {
+				fprintf(
+					file, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":%u,\"ts\":%.3f}",
+					event->name, ring->thread_index, (event->timestamp - trace_start) / ticks_per_us
+				);
+			}
+		}
+	}
+	fprintf(file, "\n]}\n");
+}
+
+#else
+	#define linux_bind_profile_thread(name)
+	#define linux_start_profiling()
+#endif
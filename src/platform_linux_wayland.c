@@ -29,13 +29,19 @@
 #include <dlfcn.h>
 #include <linux/limits.h>
 #include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
 
 // c standard library stuff
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#include "platform_linux_profile.c"
+#include "platform_linux_work_queue.c"
+
 typedef enum PointerEventMask {
 	POINTER_EVENT_ENTER         = 1 << 0,
 	POINTER_EVENT_LEAVE         = 1 << 1,
@@ -64,6 +70,12 @@ typedef struct PointerEvent {
 	uint32_t axis_source;
 } PointerEvent;
 
+// NOTE(mal): Swapchain. The buffers are all carved out of one shm pool. A buffer belongs to the
+// compositor from the moment it's attached until the compositor sends its release event (which
+// puts it back on the free list), and we only ever render into a buffer that's on the free list.
+// That way rendering the next frame overlaps with the compositor still reading the last one.
+#define SWAPCHAIN_BUFFER_COUNT 3
+
 // Wayland Client State
 // TODO(mal): Pass over this struct and update the variable types.
 // e.g. probably want to use uint32_t (or the larger size_t) for things like width and height
@@ -84,7 +96,7 @@ typedef struct ClientState {
 	struct xdg_toplevel *xdg_toplevel;
 	struct wl_keyboard *wl_keyboard;
 	struct wl_pointer *wl_pointer;
-	struct wl_buffer **wl_buffers; // nbuffers is buffer count
+	struct wl_buffer *wl_buffers[SWAPCHAIN_BUFFER_COUNT];
 	struct zxdg_toplevel_decoration_v1 *xdg_toplevel_decoration;
 	struct wp_viewport *wp_viewport;
 	/* State */
@@ -104,8 +116,10 @@ typedef struct ClientState {
 	int buffer_height;
 	int bytes_per_pixel;
 	int stride;
-	unsigned nbuffers;
-	unsigned current_buffer_index;
+	// Indices of the buffers that the compositor isn't holding on to, most recently released last
+	unsigned free_buffer_indices[SWAPCHAIN_BUFFER_COUNT];
+	unsigned free_buffer_count;
+	unsigned front_buffer_index; // last one attached
 	int shm_pool_size;
 	int closed;
 	int can_draw;
@@ -157,17 +171,20 @@ int allocate_shm_file(size_t size) {
 
 const struct wl_buffer_listener wl_buffer_listener;
 void create_buffers(ClientState *state) {
-	state->shm_pool_size = state->buffer_height * state->stride * state->nbuffers;
+	int buffer_size = state->buffer_height * state->stride;
+	state->shm_pool_size = buffer_size * SWAPCHAIN_BUFFER_COUNT;
 	int shm_fd = allocate_shm_file(state->shm_pool_size);
 	struct wl_shm_pool *pool = wl_shm_create_pool(state->shm, shm_fd, state->shm_pool_size);
-	for (int buffer_offset = 0 ; buffer_offset < state->nbuffers; buffer_offset++) {
-		state->wl_buffers[buffer_offset] = wl_shm_pool_create_buffer(
-			pool, buffer_offset,
+	for (int i = 0; i < SWAPCHAIN_BUFFER_COUNT; i++) {
+		state->wl_buffers[i] = wl_shm_pool_create_buffer(
+			pool, i * buffer_size,
 			state->buffer_width, state->buffer_height, state->stride,
 			WL_SHM_FORMAT_XRGB8888
 		);
-		wl_buffer_add_listener(state->wl_buffers[buffer_offset], &wl_buffer_listener, NULL);
+		wl_buffer_add_listener(state->wl_buffers[i], &wl_buffer_listener, state);
+		state->free_buffer_indices[i] = i;
 	}
+	state->free_buffer_count = SWAPCHAIN_BUFFER_COUNT;
 	state->shm_pool_data = mmap(NULL, state->shm_pool_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
 	// NOTE(mal): The buffer is now independent and references the underlying shared memory of the
 	// pool. It is safe to immediately destroy the shared memory pool. From the docs:
@@ -179,6 +196,41 @@ void create_buffers(ClientState *state) {
 	close(shm_fd);
 }
 
+void destroy_buffers(ClientState *state) {
+	for (int i = 0; i < SWAPCHAIN_BUFFER_COUNT; i++) {
+		wl_buffer_destroy(state->wl_buffers[i]);
+	}
+	munmap(state->shm_pool_data, state->shm_pool_size);
+}
+
+uint8_t *get_buffer_memory(ClientState *state, unsigned buffer_index) {
+	uint8_t *result = (uint8_t *)state->shm_pool_data + buffer_index * state->stride * state->buffer_height;
+	return result;
+}
+
+// Takes a buffer that's safe to render into off the free list. Returns -1 if the compositor is
+// still holding on to every buffer.
+int acquire_back_buffer(ClientState *state) {
+	if (state->free_buffer_count == 0) {
+		return -1;
+	}
+	int result = state->free_buffer_indices[--state->free_buffer_count];
+	return result;
+}
+
+// Hands the buffer over to the compositor (for the next commit). It's ours again once it's released.
+void attach_buffer(ClientState *state, unsigned buffer_index) {
+	// Re-attaching the front buffer (e.g. on configure) can happen after it's been released.
+	for (unsigned i = 0; i < state->free_buffer_count; i++) {
+		if (state->free_buffer_indices[i] == buffer_index) {
+			state->free_buffer_indices[i] = state->free_buffer_indices[--state->free_buffer_count];
+			break;
+		}
+	}
+	wl_surface_attach(state->wl_surface, state->wl_buffers[buffer_index], 0, 0);
+	state->front_buffer_index = buffer_index;
+}
+
 // TODO(mal): Instead of passing in the whole of client state do we want to instead pass in just the
 // parts that we need from it? In this case it would be
 // - compositor
@@ -215,7 +267,7 @@ void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface, uint32_t
 	// here?
 	ClientState *state = data;
 	xdg_surface_ack_configure(xdg_surface, serial);
-	wl_surface_attach(state->wl_surface, state->wl_buffers[state->current_buffer_index], 0, 0);
+	attach_buffer(state, state->front_buffer_index);
 	wl_surface_commit(state->wl_surface);
 }
 
@@ -227,8 +279,16 @@ const struct xdg_surface_listener xdg_surface_listener = {
 // WL_BUFFER_LISTENER
 //////////////////////////////////////////////////
 void wl_buffer_release(void *data, struct wl_buffer *wl_buffer) {
-	// Sent by the compositor when it's no longer using this buffer
-	wl_buffer_destroy(wl_buffer);
+	// Sent by the compositor when it's no longer using this buffer, so it can go back on the free
+	// list to be rendered into again.
+	ClientState *state = data;
+	for (unsigned i = 0; i < SWAPCHAIN_BUFFER_COUNT; i++) {
+		if (state->wl_buffers[i] == wl_buffer) {
+			ASSERT(state->free_buffer_count < SWAPCHAIN_BUFFER_COUNT);
+			state->free_buffer_indices[state->free_buffer_count++] = i;
+			break;
+		}
+	}
 }
 
 const struct wl_buffer_listener wl_buffer_listener = {
@@ -614,7 +674,10 @@ void wl_keyboard_key(
 	xkb_keysym_t sym = xkb_state_key_get_one_sym(client_state->xkb_state, keycode);
 	GameKey game_key = xkb_keysym_to_game_key(sym);
 	if (game_key != GAME_KEY_UNKNOWN) {
-		client_state->game_input->keys[game_key].is_down = key_state == WL_KEYBOARD_KEY_STATE_PRESSED;
+		// NOTE(mal): Atomic because with the sim thread running (see SimThread) it's sampling this
+		// from another thread.
+		char is_down = key_state == WL_KEYBOARD_KEY_STATE_PRESSED;
+		__atomic_store_n(&client_state->game_input->keys[game_key].is_down, is_down, __ATOMIC_RELAXED);
 	}
 }
 
@@ -711,10 +774,7 @@ void xdg_toplevel_configure(
 	// TODO(mal): Maybe make this behavior more formal by removing the buffer_width from ClientState
 	// and creating a constant FIXED_BUFFER_WIDTH global? At the moment whatever the starting
 	// buffer_width is -- that's what the fixed buffer width will be.
-	for (int i = 0; i < state->nbuffers; i++) {
-		wl_buffer_destroy(state->wl_buffers[i]);
-	}
-	munmap(state->shm_pool_data, state->shm_pool_size);
+	destroy_buffers(state);
 	// state->width = width;
 	// state->stride = width * state->bytes_per_pixel;
 	float window_aspect_ratio = (float)width / (float)height;
@@ -723,14 +783,14 @@ void xdg_toplevel_configure(
 	create_buffers(state);
 
 	// GameOffscreenBuffer game_offscreen_buffer;
-	// game_offscreen_buffer.memory          = state->shm_pool_data + (state->current_buffer_index * state->stride * state->height);
+	// game_offscreen_buffer.memory          = state->shm_pool_data + (state->front_buffer_index * state->stride * state->height);
 	// game_offscreen_buffer.width           = state->width;
 	// game_offscreen_buffer.height          = state->height;
 	// game_offscreen_buffer.bytes_per_pixel = state->bytes_per_pixel;
 
 	update_window_opaque_region(state);
 	wp_viewport_set_destination(state->wp_viewport, width, height);
-	wl_surface_attach(state->wl_surface, state->wl_buffers[state->current_buffer_index], 0, 0);
+	attach_buffer(state, state->front_buffer_index);
 	wl_surface_commit(state->wl_surface);
 }
 
@@ -853,7 +913,121 @@ void debug_platform_free_entire_file(char *file_data, size_t file_data_len) {
 	);
 }
 
-int main() {
+#ifdef PROFILING_ENABLED
+// Saves the last PROFILE_TRACE_FRAME_COUNT frames of profiling zones next to the executable, as
+// profile_trace_N.json for the Nth trace this run.
+void linux_save_profile_trace() {
+	static int trace_count = 0;
+	char file_name[64];
+	snprintf(file_name, sizeof(file_name), "profile_trace_%d.json", trace_count++);
+	FILE *file = fopen(file_name, "w");
+	if (!file) {
+		fprintf(stderr, "Failed to create %s: %s\n", file_name, strerror(errno));
+		return;
+	}
+	linux_write_profile_trace(file, PROFILE_TRACE_FRAME_COUNT);
+	fclose(file);
+	printf("Saved profile trace to %s\n", file_name);
+}
+#else
+	#define linux_save_profile_trace()
+#endif
+
+//////////////////////////////////////////////////
+// FIXED TIMESTEP
+//////////////////////////////////////////////////
+// NOTE(mal): The update timer only wakes us up. How many updates actually run is decided by how far
+// the simulation's clock (simulated_until_ns) lags behind the real one, so a late or missed wakeup
+// gets caught up on instead of silently dropping a tick.
+
+#define GAME_UPDATE_DT_NS (1000000000ull / GAME_UPDATE_HZ)
+
+uint64_t linux_get_time_ns() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t)time.tv_sec * 1000000000ull + (uint64_t)time.tv_nsec;
+}
+
+// Returns how many updates are due to catch the simulation up to now_ns. The caller then advances
+// simulated_until_ns by GAME_UPDATE_DT_NS after each one it runs.
+int linux_count_due_updates(uint64_t *simulated_until_ns, uint64_t now_ns) {
+	uint64_t due_count = now_ns > *simulated_until_ns ? (now_ns - *simulated_until_ns) / GAME_UPDATE_DT_NS : 0;
+	if (due_count > GAME_MAX_UPDATES_PER_FRAME) {
+		// Give up on the ticks past the cap for good (see GAME_MAX_UPDATES_PER_FRAME)
+		*simulated_until_ns += (due_count - GAME_MAX_UPDATES_PER_FRAME) * GAME_UPDATE_DT_NS;
+		due_count = GAME_MAX_UPDATES_PER_FRAME;
+	}
+	return (int)due_count;
+}
+
+float linux_get_interpolation_alpha(uint64_t simulated_until_ns, uint64_t now_ns) {
+	if (now_ns <= simulated_until_ns) {
+		return 0.0f;
+	}
+	float alpha = (float)(now_ns - simulated_until_ns) / (float)GAME_UPDATE_DT_NS;
+	return alpha < 1.0f ? alpha : 1.0f;
+}
+
+//////////////////////////////////////////////////
+// SIMULATION THREAD
+//////////////////////////////////////////////////
+// NOTE(mal): Optional, see main. Runs game_update at a fixed rate on its own thread so that a slow
+// render never delays input sampling or the simulation. After every update the game publishes an
+// immutable snapshot of the simulation for game_render to pick up, so the two threads never touch
+// the same state (see GameStorage in game.c).
+
+typedef struct SimThread {
+	GameMemory *game_memory;
+	GameCode *game_code;
+	// Held by the sim thread for the duration of game_update and by the main thread while it
+	// reloads the game code, so that we never dlclose code that's being run.
+	pthread_mutex_t game_code_mutex;
+	// Only is_down gets read, and atomically, since the keyboard listener writes it on the main
+	// thread. The sim thread keeps its own was_down.
+	GameInput *shared_input;
+	int update_timer_fd;
+	// Only ever written by the sim thread, read atomically by the main thread for the interpolation
+	// alpha.
+	// NOTE(mal): An update can get published between the main thread reading this and game_render
+	// picking up its snapshot, in which case that frame's alpha is for the tick before. It's off by
+	// a tick for a frame at worst.
+	uint64_t *simulated_until_ns;
+} SimThread;
+
+void *linux_sim_thread_proc(void *param) {
+	SimThread *sim_thread = param;
+	linux_bind_profile_thread("sim");
+	GameInput sim_input = {0};
+	while (1) {
+		// Blocks until the next tick
+		unsigned long expirations;
+		read(sim_thread->update_timer_fd, &expirations, sizeof(expirations));
+
+		for (int i = 0; i < NUM_GAME_KEYS; i++) {
+			sim_input.keys[i].is_down = __atomic_load_n(&sim_thread->shared_input->keys[i].is_down, __ATOMIC_RELAXED);
+		}
+
+		uint64_t simulated_until_ns = *sim_thread->simulated_until_ns;
+		int update_count = linux_count_due_updates(&simulated_until_ns, linux_get_time_ns());
+		for (int update_index = 0; update_index < update_count; update_index++) {
+			pthread_mutex_lock(&sim_thread->game_code_mutex);
+			sim_thread->game_code->game_update(sim_thread->game_memory, &sim_input, GAME_UPDATE_DT);
+			pthread_mutex_unlock(&sim_thread->game_code_mutex);
+
+			for (int i = 0; i < NUM_GAME_KEYS; i++) {
+				sim_input.keys[i].was_down = sim_input.keys[i].is_down;
+			}
+			simulated_until_ns += GAME_UPDATE_DT_NS;
+			__atomic_store_n(sim_thread->simulated_until_ns, simulated_until_ns, __ATOMIC_RELEASE);
+		}
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	// With --sim-thread, game_update runs on its own thread and the main loop only renders.
+	int use_sim_thread = argc > 1 && strcmp(argv[1], "--sim-thread") == 0;
+
 	char exe_path[PATH_MAX];
 	ssize_t exe_path_len = readlink("/proc/self/exe", exe_path, sizeof(exe_path) - 1);
 	ASSERT_MSG(exe_path_len > 0, "Failed to get path of executable");
@@ -868,8 +1042,6 @@ int main() {
 	int chdir_result = chdir(exe_dir_path);
 	ASSERT(chdir_result == 0);
 
-	#define NBUFFERS 1 // just single buffering at the moment
-
 	ClientState client_state     = {0};
 	client_state.xkb_context     = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
 	client_state.buffer_width    = 800;
@@ -880,9 +1052,7 @@ int main() {
 	client_state.window_height   = 600;
 	client_state.bytes_per_pixel = 4;
 	client_state.stride          = client_state.buffer_width * client_state.bytes_per_pixel;
-	client_state.nbuffers        = NBUFFERS;
-	client_state.wl_buffers      = (struct wl_buffer *[NBUFFERS]){0}; // just store it here on the stack for now
-	client_state.shm_pool_size   = client_state.buffer_height * client_state.stride * client_state.nbuffers;
+	client_state.shm_pool_size   = client_state.buffer_height * client_state.stride * SWAPCHAIN_BUFFER_COUNT;
 
 	client_state.wl_display = wl_display_connect(NULL);
 	ASSERT(client_state.wl_display);
@@ -928,7 +1098,7 @@ int main() {
 	struct wl_callback *surface_frame_callback  = wl_surface_frame(client_state.wl_surface);
 	wl_callback_add_listener(surface_frame_callback, &wl_surface_frame_listener, &client_state);
 
-	#define TARGET_FPS 60
+	#define TARGET_FPS GAME_UPDATE_HZ
 	#define TARGET_FRAMETIME_NS ((1.0 / TARGET_FPS) * 1e9)
 	// 0 - blocks, use TFD_NONBLOCK for nonblocking
 	// NOTE(mal): In this case it doesn't matter because I'm using `poll` to check
@@ -938,14 +1108,36 @@ int main() {
 	struct timespec update_timer_interval = { .tv_nsec  = TARGET_FRAMETIME_NS };
 	struct itimerspec update_timer_spec   = { .it_value = update_timer_value, .it_interval = update_timer_interval };
 	timerfd_settime(update_timer_fd, 0, &update_timer_spec, NULL);
+	// NOTE(mal): When the sim thread owns the update timer, the main loop still wakes up at the same
+	// rate on a timer of its own, it just only renders when it does.
+	int render_timer_fd = update_timer_fd;
+	if (use_sim_thread) {
+		render_timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+		timerfd_settime(render_timer_fd, 0, &update_timer_spec, NULL);
+	}
 
 	GameCode game_code = load_game_code();
 
 	GameMemory game_memory = {0};
 	game_memory.debug_platform_read_entire_file = debug_platform_read_entire_file;
 	game_memory.debug_platform_free_entire_file = debug_platform_free_entire_file;
-	game_memory.storage_size = 4ul * 1024ul * 1024ul;
+	game_memory.storage_size = 192ul * 1024ul * 1024ul;
 	game_memory.storage = mmap(NULL, game_memory.storage_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef PROFILING_ENABLED
+	game_memory.platform_get_profile_ring = platform_get_profile_ring;
+#endif
+	PROFILE_SET_GET_RING(platform_get_profile_ring);
+	linux_start_profiling();
+
+	// NOTE(mal): The main thread also works the queue while it waits in platform_complete_all_work,
+	// so we only spawn one worker per additional core.
+	static PlatformWorkQueue render_queue;
+	long core_count = sysconf(_SC_NPROCESSORS_ONLN);
+	int render_worker_count = core_count > 1 ? (int)core_count - 1 : 0;
+	linux_make_work_queue(&render_queue, render_worker_count);
+	game_memory.render_queue = &render_queue;
+	game_memory.platform_add_work_queue_entry = platform_add_work_queue_entry;
+	game_memory.platform_complete_all_work    = platform_complete_all_work;
 
 	GameInput game_input = {0};
 	// NOTE(mal): Going to send the game input through our wayland listeners to collect keyboard input.
@@ -956,15 +1148,34 @@ int main() {
 
 	game_code.game_init(&game_memory, client_state.buffer_width, client_state.buffer_height);
 
+	uint64_t simulated_until_ns = linux_get_time_ns();
+
+	static SimThread sim_thread;
+	if (use_sim_thread) {
+		sim_thread = (SimThread){
+			.game_memory        = &game_memory,
+			.game_code          = &game_code,
+			.shared_input       = &game_input,
+			.update_timer_fd    = update_timer_fd,
+			.simulated_until_ns = &simulated_until_ns,
+		};
+		pthread_mutex_init(&sim_thread.game_code_mutex, NULL);
+		pthread_t thread;
+		int create_result = pthread_create(&thread, NULL, linux_sim_thread_proc, &sim_thread);
+		ASSERT(create_result == 0);
+		pthread_detach(thread);
+	}
+
 	#define WAYLAND_DISPLAY_POLL 0
 	#define UPDATE_TIMER_POLL    1
 	struct pollfd pollfds[] = {
 		[WAYLAND_DISPLAY_POLL] = { .fd = client_state.wl_display_fd, .events = POLLIN },
-		[UPDATE_TIMER_POLL]    = { .fd = update_timer_fd,     .events = POLLIN },
+		[UPDATE_TIMER_POLL]    = { .fd = render_timer_fd,     .events = POLLIN },
 	};
 	size_t num_pollfds = sizeof(pollfds) / sizeof(struct pollfd);
-	// TODO(mal): Now that we have the ability to easily double buffer, we could draw to our
-	// backbuffer whenever convenient while Wayland is still presenting our front buffer.
+	char was_trace_key_down = 0;
+	// NOTE(mal): We draw into a back buffer from the swapchain while the compositor is still
+	// presenting the front one, but still only once per frame callback.
 	while (1) {
 		int needs_draw = 0;
 
@@ -975,9 +1186,11 @@ int main() {
 		// TODO(mal): Check access with R_OK | X_OK instead of just F_OK?
 		// NOTE(mal): Hot-reloading gotcha! https://stackoverflow.com/questions/56334288/how-to-hot-reload-shared-library-on-linux
 		if (game_so_stat.st_mtime > game_code.last_modified_time && access("./game.lock", F_OK) != 0) {
+			if (use_sim_thread) pthread_mutex_lock(&sim_thread.game_code_mutex);
 			int dlclose_result = dlclose(game_code.lib_handle);
 			ASSERT(dlclose_result == 0);
 			game_code = load_game_code();
+			if (use_sim_thread) pthread_mutex_unlock(&sim_thread.game_code_mutex);
 		}
 
 		// 0 on success, -1 if queue was not empty
@@ -1015,21 +1228,34 @@ int main() {
 			unsigned long expirations;
 			// If we don't read the timer the POLLIN revents bit will never be cleared
 			read(pollfds[UPDATE_TIMER_POLL].fd, &expirations, sizeof(expirations));
-
-			game_code.game_update(&game_memory, &game_input);
-
-			for (int i = 0; i < NUM_GAME_KEYS; i++) {
-				game_input.keys[i].was_down = game_input.keys[i].is_down;
+			PROFILE_FRAME_MARKER();
+
+			if (!use_sim_thread) {
+				int update_count = linux_count_due_updates(&simulated_until_ns, linux_get_time_ns());
+				for (int update_index = 0; update_index < update_count; update_index++) {
+					game_code.game_update(&game_memory, &game_input, GAME_UPDATE_DT);
+
+					for (int i = 0; i < NUM_GAME_KEYS; i++) {
+						game_input.keys[i].was_down = game_input.keys[i].is_down;
+					}
+					simulated_until_ns += GAME_UPDATE_DT_NS;
+				}
 			}
 
 			needs_draw = 1;
 		}
 
+		// NOTE(mal): If the compositor is still holding on to every buffer we skip this draw rather
+		// than render into memory it may be reading from. The next update will try again.
+		int back_buffer_index = -1;
 		if (client_state.can_draw && needs_draw) {
+			back_buffer_index = acquire_back_buffer(&client_state);
+		}
+		if (back_buffer_index >= 0) {
 			client_state.can_draw = 0;
 
 			GameOffscreenBuffer game_offscreen_buffer;
-			game_offscreen_buffer.memory          = client_state.shm_pool_data + (client_state.current_buffer_index * client_state.stride * client_state.buffer_height);
+			game_offscreen_buffer.memory          = get_buffer_memory(&client_state, back_buffer_index);
 			game_offscreen_buffer.width           = client_state.buffer_width;
 			game_offscreen_buffer.height          = client_state.buffer_height;
 			game_offscreen_buffer.bytes_per_pixel = client_state.bytes_per_pixel;
@@ -1037,7 +1263,10 @@ int main() {
 			struct timespec render_time_start;
 			clock_gettime(CLOCK_MONOTONIC_RAW, &render_time_start);
 
-			game_code.game_render(&game_memory, &game_offscreen_buffer);
+			float interpolation_alpha = linux_get_interpolation_alpha(
+				__atomic_load_n(&simulated_until_ns, __ATOMIC_ACQUIRE), linux_get_time_ns()
+			);
+			game_code.game_render(&game_memory, &game_offscreen_buffer, interpolation_alpha);
 			
 			struct timespec render_time_end;
 			clock_gettime(CLOCK_MONOTONIC_RAW, &render_time_end);
@@ -1051,22 +1280,34 @@ int main() {
 			uint32_t projected_fps = (1.0f / render_time_ms * 1000.0f);
 			printf("Render time ms: %f, (fake) fps: %d\n", render_time_ms, projected_fps);
 
+			PROFILE_BEGIN("present");
 			// Request a new callback
 			// IMPORTANT(mal): We have to request a surface frame BEFORE we commit the surface!
 			wl_callback_add_listener(wl_surface_frame(client_state.wl_surface), &wl_surface_frame_listener, &client_state);
 
-			// NOTE(mal): We could probably optimize the layout of our ClientState struct so that
-			// wl_buffers and current_buffer are right next to each other and therefore hopefully
-			// only require one cache line load to do the common "buffers[current_buffer]" indexing.
-			wl_surface_attach(client_state.wl_surface, client_state.wl_buffers[client_state.current_buffer_index], 0, 0);
-			wl_surface_damage_buffer(client_state.wl_surface, 0, 0, INT32_MAX, INT32_MAX);
+			attach_buffer(&client_state, back_buffer_index);
+			// Only what the game reports as changed needs to be re-uploaded by the compositor. We still
+			// commit when nothing changed, otherwise we'd never get our next frame callback.
+			for (int i = 0; i < game_offscreen_buffer.damage_rect_count; i++) {
+				GameRect *rect = &game_offscreen_buffer.damage_rects[i];
+				wl_surface_damage_buffer(client_state.wl_surface, rect->x, rect->y, rect->width, rect->height);
+			}
 			wl_surface_commit(client_state.wl_surface);
+			PROFILE_END("present");
+		}
+
+		// NOTE(mal): F12 is the platform's, the game never sees it as anything but a key.
+		char is_trace_key_down = __atomic_load_n(&game_input.keys[GAME_KEY_F12].is_down, __ATOMIC_RELAXED);
+		if (is_trace_key_down && !was_trace_key_down) {
+			linux_save_profile_trace();
 		}
+		was_trace_key_down = is_trace_key_down;
 
 		if (client_state.closed) {
 			break;
 		}
 	}
 
+	linux_save_profile_trace();
 	return 0;
 }
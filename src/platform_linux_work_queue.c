@@ -0,0 +1,94 @@
+// NOTE(mal): Shared by the Linux platform layers, which #include this file directly rather than
+// building it on its own. Expects platform.h, pthread.h, semaphore.h and platform_linux_profile.c to
+// already be included.
+
+//////////////////////////////////////////////////
+// WORK QUEUE
+//////////////////////////////////////////////////
+// NOTE(mal): Single producer, multiple consumer ring buffer. Only the thread that adds entries may
+// call platform_complete_all_work. Worker threads sleep on the semaphore whenever the queue is empty.
+// See Casey Muratori's "Handmade Hero" days 122-126 for the design this is based on.
+
+typedef struct PlatformWorkQueueEntry {
+	PlatformWorkQueueCallback callback;
+	void *data;
+} PlatformWorkQueueEntry;
+
+#define WORK_QUEUE_ENTRY_COUNT 256
+struct PlatformWorkQueue {
+	volatile uint32_t completion_goal;
+	volatile uint32_t completion_count;
+	volatile uint32_t next_entry_to_write;
+	volatile uint32_t next_entry_to_read;
+	sem_t semaphore;
+	PlatformWorkQueueEntry entries[WORK_QUEUE_ENTRY_COUNT];
+};
+
+// Returns whether there was anything in the queue (even if another thread beat us to it).
+int linux_do_next_work_queue_entry(PlatformWorkQueue *queue) {
+	uint32_t original_next_entry_to_read = __atomic_load_n(&queue->next_entry_to_read, __ATOMIC_ACQUIRE);
+	if (original_next_entry_to_read == __atomic_load_n(&queue->next_entry_to_write, __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+
+	// NOTE(mal): Copy the entry out BEFORE claiming it. Once we bump next_entry_to_read the producer
+	// is free to overwrite the slot.
+	PlatformWorkQueueEntry entry = queue->entries[original_next_entry_to_read];
+	uint32_t new_next_entry_to_read = (original_next_entry_to_read + 1) % WORK_QUEUE_ENTRY_COUNT;
+	bool claimed = __atomic_compare_exchange_n(
+		&queue->next_entry_to_read, &original_next_entry_to_read, new_next_entry_to_read,
+		false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST
+	);
+	if (claimed) {
+		entry.callback(queue, entry.data);
+		__atomic_add_fetch(&queue->completion_count, 1, __ATOMIC_SEQ_CST);
+	}
+
+	return 1;
+}
+
+void platform_add_work_queue_entry(PlatformWorkQueue *queue, PlatformWorkQueueCallback callback, void *data) {
+	uint32_t next_entry_to_write     = queue->next_entry_to_write;
+	uint32_t new_next_entry_to_write = (next_entry_to_write + 1) % WORK_QUEUE_ENTRY_COUNT;
+	// If the queue is full then help drain it instead of overwriting unread entries.
+	while (new_next_entry_to_write == __atomic_load_n(&queue->next_entry_to_read, __ATOMIC_ACQUIRE)) {
+		linux_do_next_work_queue_entry(queue);
+	}
+
+	queue->entries[next_entry_to_write] = (PlatformWorkQueueEntry){ .callback = callback, .data = data };
+	queue->completion_goal++;
+	// Publish the entry only once it has been completely written.
+	__atomic_store_n(&queue->next_entry_to_write, new_next_entry_to_write, __ATOMIC_RELEASE);
+	sem_post(&queue->semaphore);
+}
+
+void platform_complete_all_work(PlatformWorkQueue *queue) {
+	while (queue->completion_goal != __atomic_load_n(&queue->completion_count, __ATOMIC_ACQUIRE)) {
+		linux_do_next_work_queue_entry(queue);
+	}
+	queue->completion_goal = 0;
+	__atomic_store_n(&queue->completion_count, 0, __ATOMIC_RELEASE);
+}
+
+void *linux_work_queue_thread_proc(void *param) {
+	PlatformWorkQueue *queue = param;
+	linux_bind_profile_thread("render worker");
+	while (1) {
+		if (!linux_do_next_work_queue_entry(queue)) {
+			sem_wait(&queue->semaphore);
+		}
+	}
+	return NULL;
+}
+
+void linux_make_work_queue(PlatformWorkQueue *queue, int thread_count) {
+	*queue = (PlatformWorkQueue){0};
+	int sem_init_result = sem_init(&queue->semaphore, 0, 0);
+	ASSERT(sem_init_result == 0);
+	for (int i = 0; i < thread_count; i++) {
+		pthread_t thread;
+		int create_result = pthread_create(&thread, NULL, linux_work_queue_thread_proc, queue);
+		ASSERT(create_result == 0);
+		pthread_detach(thread);
+	}
+}
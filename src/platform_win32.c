@@ -1,5 +1,6 @@
 #include "platform.h"
 #include <windows.h>
+#include <intrin.h> // _ReadBarrier, _WriteBarrier
 
 typedef struct OffscreenBuffer {
     BITMAPINFO info;
@@ -105,6 +106,30 @@ void display_offscreen_buffer_in_window(OffscreenBuffer *buffer, HDC window_devi
     );
 }
 
+// Same as display_offscreen_buffer_in_window but only copies the given rects of the buffer.
+void display_offscreen_buffer_rects_in_window(OffscreenBuffer *buffer, HDC window_device_context, int client_width, int client_height, GameRect *rects, int rect_count) {
+    for (int i = 0; i < rect_count; i++) {
+        GameRect *rect = &rects[i];
+        // Scale the rect's edges (rather than its size) so that neighboring rects meet exactly.
+        int dest_min_x = rect->x * client_width / buffer->width;
+        int dest_min_y = rect->y * client_height / buffer->height;
+        int dest_max_x = (rect->x + rect->width) * client_width / buffer->width;
+        int dest_max_y = (rect->y + rect->height) * client_height / buffer->height;
+        // NOTE(mal): GDI measures the source rect's y from the bottom of the DIB even when the DIB
+        // is top-down.
+        int source_y = buffer->height - (rect->y + rect->height);
+        StretchDIBits(
+            window_device_context,
+            dest_min_x, dest_min_y, dest_max_x - dest_min_x, dest_max_y - dest_min_y,
+            rect->x, source_y, rect->width, rect->height,
+            buffer->memory,
+            &buffer->info,
+            DIB_RGB_COLORS,
+            SRCCOPY
+        );
+    }
+}
+
 inline uint64_t get_wall_clock() {
     LARGE_INTEGER result;
     QueryPerformanceCounter(&result);
@@ -143,6 +168,116 @@ void debug_windows_free_entire_file(char *file_data, size_t file_len) {
 	VirtualFree(file_data, file_len, MEM_RELEASE);
 }
 
+// NOTE(mal): Single producer, multiple consumer ring buffer. Only the thread that adds entries may
+// call platform_complete_all_work. Worker threads sleep on the semaphore whenever the queue is empty.
+// See Casey Muratori's "Handmade Hero" days 122-126 for the design this is based on.
+typedef struct PlatformWorkQueueEntry {
+    PlatformWorkQueueCallback callback;
+    void *data;
+} PlatformWorkQueueEntry;
+
+#define WORK_QUEUE_ENTRY_COUNT 256
+struct PlatformWorkQueue {
+    volatile LONG completion_goal;
+    volatile LONG completion_count;
+    volatile LONG next_entry_to_write;
+    volatile LONG next_entry_to_read;
+    HANDLE semaphore;
+    PlatformWorkQueueEntry entries[WORK_QUEUE_ENTRY_COUNT];
+};
+
+// Returns whether there was anything in the queue (even if another thread beat us to it).
+bool win32_do_next_work_queue_entry(PlatformWorkQueue *queue) {
+    LONG original_next_entry_to_read = queue->next_entry_to_read;
+    if (original_next_entry_to_read == queue->next_entry_to_write) {
+        return false;
+    }
+
+    // NOTE(mal): Copy the entry out BEFORE claiming it. Once we bump next_entry_to_read the
+    // producer is free to overwrite the slot.
+    PlatformWorkQueueEntry entry = queue->entries[original_next_entry_to_read];
+    _ReadBarrier();
+    LONG new_next_entry_to_read = (original_next_entry_to_read + 1) % WORK_QUEUE_ENTRY_COUNT;
+    LONG previous = InterlockedCompareExchange(&queue->next_entry_to_read, new_next_entry_to_read, original_next_entry_to_read);
+    if (previous == original_next_entry_to_read) {
+        entry.callback(queue, entry.data);
+        InterlockedIncrement(&queue->completion_count);
+    }
+
+    return true;
+}
+
+void platform_add_work_queue_entry(PlatformWorkQueue *queue, PlatformWorkQueueCallback callback, void *data) {
+    LONG next_entry_to_write = queue->next_entry_to_write;
+    LONG new_next_entry_to_write = (next_entry_to_write + 1) % WORK_QUEUE_ENTRY_COUNT;
+    // If the queue is full then help drain it instead of overwriting unread entries.
+    while (new_next_entry_to_write == queue->next_entry_to_read) {
+        win32_do_next_work_queue_entry(queue);
+    }
+
+    queue->entries[next_entry_to_write].callback = callback;
+    queue->entries[next_entry_to_write].data = data;
+    queue->completion_goal++;
+    // Publish the entry only once it has been completely written.
+    _WriteBarrier();
+    queue->next_entry_to_write = new_next_entry_to_write;
+    ReleaseSemaphore(queue->semaphore, 1, NULL);
+}
+
+void platform_complete_all_work(PlatformWorkQueue *queue) {
+    while (queue->completion_goal != queue->completion_count) {
+        win32_do_next_work_queue_entry(queue);
+    }
+    queue->completion_goal = 0;
+    queue->completion_count = 0;
+}
+
+DWORD WINAPI win32_work_queue_thread_proc(LPVOID param) {
+    PlatformWorkQueue *queue = (PlatformWorkQueue *)param;
+    PROFILE_BIND_THREAD();
+    while (true) {
+        if (!win32_do_next_work_queue_entry(queue)) {
+            WaitForSingleObjectEx(queue->semaphore, INFINITE, FALSE);
+        }
+    }
+}
+
+void win32_make_work_queue(PlatformWorkQueue *queue, int thread_count) {
+    ZeroMemory(queue, sizeof(*queue));
+    queue->semaphore = CreateSemaphoreExW(NULL, 0, thread_count > 0 ? thread_count : 1, NULL, 0, SEMAPHORE_ALL_ACCESS);
+    for (int i = 0; i < thread_count; i++) {
+        HANDLE thread = CreateThread(NULL, 0, win32_work_queue_thread_proc, queue, 0, NULL);
+        CloseHandle(thread);
+    }
+}
+
+// NOTE(mal): The rings that profile.h's zones get recorded into, one per thread that has recorded
+// anything, handed out in the order threads first ask for one. Threads past PROFILE_MAX_THREADS
+// just don't get profiled.
+#ifdef PROFILING_ENABLED
+#define PROFILE_MAX_THREADS 32
+typedef struct ProfileRings {
+    // Can overshoot PROFILE_MAX_THREADS
+    volatile LONG count;
+    ProfileRing rings[PROFILE_MAX_THREADS];
+} ProfileRings;
+
+static ProfileRings profile_rings;
+static PROFILE_THREAD_LOCAL ProfileRing *win32_thread_profile_ring;
+
+ProfileRing *platform_get_profile_ring(void) {
+    if (!win32_thread_profile_ring) {
+        LONG thread_index = InterlockedIncrement(&profile_rings.count) - 1;
+        if (thread_index >= PROFILE_MAX_THREADS) {
+            return NULL;
+        }
+        win32_thread_profile_ring = &profile_rings.rings[thread_index];
+        win32_thread_profile_ring->thread_index = (uint32_t)thread_index;
+    }
+    return win32_thread_profile_ring;
+}
+#endif
+
 LRESULT CALLBACK window_proc(HWND window, UINT message, WPARAM w_param, LPARAM l_param) {
     LRESULT result = 0;
 
@@ -284,10 +419,10 @@ int WINAPI WinMain(HINSTANCE instance, HINSTANCE prev_instance, LPSTR cmd_line,
     offscreen_buffer.info.bmiHeader.biBitCount = offscreen_buffer.bytes_per_pixel * 8;
     offscreen_buffer.info.bmiHeader.biCompression = BI_RGB;
 
-    #define kibibytes(n) n * 1024ll
-    #define mebibytes(n) n * kibibytes(n)
-    #define gibibytes(n) n * mebibytes(n)
-    const size_t GAME_STORAGE_SIZE = mebibytes(128);
+    #define kibibytes(n) ((n) * 1024ll)
+    #define mebibytes(n) (kibibytes(n) * 1024ll)
+    #define gibibytes(n) (mebibytes(n) * 1024ll)
+    const size_t GAME_STORAGE_SIZE = mebibytes(192);
     GameMemory game_memory = {};
     game_memory.storage_size = GAME_STORAGE_SIZE;
     game_memory.storage = VirtualAlloc(
@@ -302,6 +437,22 @@ int WINAPI WinMain(HINSTANCE instance, HINSTANCE prev_instance, LPSTR cmd_line,
     }
 	game_memory.debug_platform_read_entire_file = debug_windows_read_entire_file;
 	game_memory.debug_platform_free_entire_file = debug_windows_free_entire_file;
+#ifdef PROFILING_ENABLED
+    game_memory.platform_get_profile_ring = platform_get_profile_ring;
+#endif
+    PROFILE_SET_GET_RING(platform_get_profile_ring);
+    PROFILE_BIND_THREAD();
+
+    // NOTE(mal): The main thread also works the queue while it waits in platform_complete_all_work,
+    // so we only spawn one worker per additional core.
+    static PlatformWorkQueue render_queue;
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    int render_worker_count = system_info.dwNumberOfProcessors > 1 ? (int)system_info.dwNumberOfProcessors - 1 : 0;
+    win32_make_work_queue(&render_queue, render_worker_count);
+    game_memory.render_queue = &render_queue;
+    game_memory.platform_add_work_queue_entry = platform_add_work_queue_entry;
+    game_memory.platform_complete_all_work = platform_complete_all_work;
 
     game_code.game_init(&game_memory, offscreen_buffer.width, offscreen_buffer.height);
 
@@ -330,6 +481,11 @@ int WINAPI WinMain(HINSTANCE instance, HINSTANCE prev_instance, LPSTR cmd_line,
     game_is_running = true;
     // TODO(mal): should this initialize to 0?
     uint64_t frame_start_wall_clock = get_wall_clock();
+    // NOTE(mal): The frame pacing below has no say in how many updates run. That's decided by how far
+    // the simulation's clock lags behind the wall clock (see GAME_UPDATE_PARAMS), so a long frame gets
+    // caught up on in the next one instead of slowing the game down.
+    uint64_t update_dt_wall_clock = wall_clock_frequency / GAME_UPDATE_HZ;
+    uint64_t simulated_until_wall_clock = frame_start_wall_clock;
     GameInput game_input = {};
     while (game_is_running) {
         WIN32_FILE_ATTRIBUTE_DATA dll_attribs;
@@ -401,23 +557,40 @@ int WINAPI WinMain(HINSTANCE instance, HINSTANCE prev_instance, LPSTR cmd_line,
             }
         }
 
-        game_code.game_update(&game_memory, &game_input);
-		
-		for (int i = 0; i < NUM_GAME_KEYS; i++) {
-			game_input.keys[i].was_down = game_input.keys[i].is_down;
-		}
+        uint64_t update_count = (get_wall_clock() - simulated_until_wall_clock) / update_dt_wall_clock;
+        if (update_count > GAME_MAX_UPDATES_PER_FRAME) {
+            // Give up on the ticks past the cap for good
+            simulated_until_wall_clock += (update_count - GAME_MAX_UPDATES_PER_FRAME) * update_dt_wall_clock;
+            update_count = GAME_MAX_UPDATES_PER_FRAME;
+        }
+        for (uint64_t update_index = 0; update_index < update_count; update_index++) {
+            game_code.game_update(&game_memory, &game_input, GAME_UPDATE_DT);
+
+            for (int i = 0; i < NUM_GAME_KEYS; i++) {
+                game_input.keys[i].was_down = game_input.keys[i].is_down;
+            }
+            simulated_until_wall_clock += update_dt_wall_clock;
+        }
+        float interpolation_alpha = (float)(get_wall_clock() - simulated_until_wall_clock) / (float)update_dt_wall_clock;
+        if (interpolation_alpha > 1.0f) {
+            interpolation_alpha = 1.0f;
+        }
 
         GameOffscreenBuffer buf;
         buf.memory = offscreen_buffer.memory;
         buf.width = offscreen_buffer.width;
         buf.height = offscreen_buffer.height;
         buf.bytes_per_pixel = offscreen_buffer.bytes_per_pixel;
-        game_code.game_render(&game_memory, &buf);
+        game_code.game_render(&game_memory, &buf, interpolation_alpha);
 
+        PROFILE_BEGIN("present");
         HDC device_context = GetDC(game_window);
         WindowClientDimensions client = get_window_client_dimensions(game_window);
-        display_offscreen_buffer_in_window(&offscreen_buffer, device_context, client.width, client.height);
+        display_offscreen_buffer_rects_in_window(
+            &offscreen_buffer, device_context, client.width, client.height, buf.damage_rects, buf.damage_rect_count
+        );
         ReleaseDC(game_window, device_context);
+        PROFILE_END("present");
 
         uint64_t work_end_wall_clock = get_wall_clock();
         float frame_work_seconds_elapsed = get_seconds_elapsed(work_end_wall_clock, frame_start_wall_clock);
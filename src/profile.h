@@ -0,0 +1,95 @@
+// Profiling zones, shared by the game and the platform layers (included by platform.h).
+//
+// PROFILE_BEGIN(name) and PROFILE_END(name) bracket a zone, name being a string literal. Each one
+// records an rdtsc timestamp into the calling thread's ProfileRing. PROFILE_FRAME_MARKER() marks
+// the start of a frame, for the platform's main loop. The platform owns the rings and hands each
+// thread its own through platform_get_profile_ring (GameMemory carries it over to the game), and is
+// what eventually reads them back.
+// A thread only records once PROFILE_BIND_THREAD() has looked up its ring, which keeps the lookup
+// out of every event. The binding is per module, so the platform binds in its thread procs and the
+// game in the functions threads enter it through (again after a hot reload, which starts it over).
+// NOTE(mal): Without PROFILING_ENABLED the macros are empty and none of this costs anything, but the
+// types stay around so that GameMemory looks the same either way.
+// WARN(mal): Zones have to nest properly within a thread, and both ends have to use the same name.
+
+#pragma once
+
+#include <stdint.h>
+
+typedef enum ProfileEventType {
+	PROFILE_EVENT_BEGIN,
+	PROFILE_EVENT_END,
+	PROFILE_EVENT_FRAME,
+} ProfileEventType;
+
+typedef struct ProfileEvent {
+	uint64_t timestamp; // rdtsc
+	const char *name;
+	uint32_t type; // ProfileEventType
+} ProfileEvent;
+
+// Single producer (the thread it belongs to), so recording doesn't need any atomics beyond the
+// release store of write_index. Once full it wraps around and overwrites the oldest events.
+#define PROFILE_RING_EVENT_COUNT (1 << 16)
+typedef struct ProfileRing {
+	// Total events ever recorded, the next one goes in events[write_index % PROFILE_RING_EVENT_COUNT].
+	volatile uint64_t write_index;
+	uint32_t thread_index;
+	const char *thread_name; // set by the platform, NULL if it didn't
+	ProfileEvent events[PROFILE_RING_EVENT_COUNT];
+} ProfileRing;
+
+// Returns the calling thread's ring, or NULL if there's no room for another thread's.
+#define PLATFORM_GET_PROFILE_RING_PARAMS (void)
+typedef ProfileRing *(*PlatformGetProfileRingFunction) PLATFORM_GET_PROFILE_RING_PARAMS;
+
+#ifdef PROFILING_ENABLED
+	#if !defined(__x86_64__) && !defined(_M_X64)
+		#error "PROFILING_ENABLED needs rdtsc, which we only have on x64"
+	#endif
+
+	#if defined(_MSC_VER)
+		#include <intrin.h>
+		#define PROFILE_THREAD_LOCAL __declspec(thread)
+		#define profile_store_release(pointer, value) (_WriteBarrier(), *(pointer) = (value))
+	#else
+		#include <x86intrin.h>
+		#define PROFILE_THREAD_LOCAL _Thread_local
+		#define profile_store_release(pointer, value) __atomic_store_n((pointer), (value), __ATOMIC_RELEASE)
+	#endif
+
+	// NOTE(mal): Per module, since every module is a single translation unit: the game lib sets its
+	// copy from GameMemory (again after every hot reload), the platform sets its own at startup.
+	static PlatformGetProfileRingFunction profile_get_ring;
+	static PROFILE_THREAD_LOCAL ProfileRing *profile_thread_ring;
+
+	// Does nothing if the thread is already bound, so it's fine to call on every way in.
+	static inline void profile_bind_thread(void) {
+		if (!profile_thread_ring && profile_get_ring) {
+			profile_thread_ring = profile_get_ring();
+		}
+	}
+
+	static inline void profile_record(const char *name, ProfileEventType type) {
+		ProfileRing *ring = profile_thread_ring;
+		if (!ring) return; // not bound, or out of rings
+		uint64_t index = ring->write_index;
+		ProfileEvent *event = &ring->events[index & (PROFILE_RING_EVENT_COUNT - 1)];
+		event->timestamp = __rdtsc();
+		event->name = name;
+		event->type = type;
+		profile_store_release(&ring->write_index, index + 1);
+	}
+
+	#define PROFILE_SET_GET_RING(function) (profile_get_ring = (function))
+	#define PROFILE_BIND_THREAD() profile_bind_thread()
+	#define PROFILE_BEGIN(name) profile_record((name), PROFILE_EVENT_BEGIN)
+	#define PROFILE_END(name)   profile_record((name), PROFILE_EVENT_END)
+	#define PROFILE_FRAME_MARKER() profile_record("frame", PROFILE_EVENT_FRAME)
+#else
+	#define PROFILE_SET_GET_RING(function)
+	#define PROFILE_BIND_THREAD()
+	#define PROFILE_BEGIN(name)
+	#define PROFILE_END(name)
+	#define PROFILE_FRAME_MARKER()
+#endif
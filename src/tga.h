@@ -0,0 +1,27 @@
+// TGA file layout, shared between the game (which loads its textures from TGAs) and the platforms
+// (which can dump frames as TGAs).
+
+#pragma once
+
+// http://www.paulbourke.net/dataformats/tga/
+#pragma pack(push, 1)
+typedef struct TGA_Header {
+	char  idlength;
+	char  colourmaptype;
+	char  datatypecode;
+	short colourmaporigin;
+	short colourmaplength;
+	char  colourmapdepth;
+	short x_origin;
+	short y_origin;
+	short width;
+	short height;
+	char  bitsperpixel;
+	char  imagedescriptor;
+} TGA_Header;
+#pragma pack(pop)
+
+// Uncompressed true colour, the only kind we read or write.
+#define TGA_DATATYPE_RGB 2
+// Bit 5 of imagedescriptor: rows go top to bottom instead of bottom to top.
+#define TGA_DESCRIPTOR_TOP_LEFT_ORIGIN 0x20